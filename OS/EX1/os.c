@@ -4,51 +4,236 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <err.h>
-#include <sys/mman.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "os.h"
+#include "pt_ext.h"
 
-/* 2^20 pages ought to be enough for anybody */
-#define NPAGES (1024 * 1024)
+/*
+ * Test driver and benchmarks for pt.c and the extensions of pt_ext.c:
+ *
+ *	gcc -O2 -std=c11 -pthread -o os os.c pt_ext.c pt.c
+ *	./os [tlb-bench | range-bench | cpt-bench]
+ */
 
-static char *pages[NPAGES];
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
-uint64_t alloc_page_frame(void)
+/*
+ * Zipf(1) lookups over 'npages' mapped VPNs, timed with and without the
+ * translation caches. The VPNs come in runs of 64 contiguous pages scattered
+ * across the address space, the way heaps and stacks map.
+ */
+static int tlb_bench(uint64_t npages, uint64_t nlookups)
 {
-	static uint64_t nalloc;
-	uint64_t ppn;
-	void *va;
+	uint64_t pt = alloc_page_frame();
+	uint64_t *vpns = malloc(npages * sizeof(*vpns));
+	uint64_t *trace = malloc(nlookups * sizeof(*trace));
+	double *cdf = malloc(npages * sizeof(*cdf));
+	double total = 0, t0, walk_s, cached_s;
+	uint64_t sum = 0, base = 0;
+	struct tlb_stats stats;
+
+	if (!vpns || !trace || !cdf)
+		err(1, "malloc failed");
+
+	srand(1);
+	for (uint64_t i = 0; i < npages; i++) {
+		if (i % 64 == 0)
+			base = ((uint64_t)rand() << 20 ^ (uint64_t)rand() << 6) & ((1ULL << (PT_LEVELS * PT_BITS)) - 1);
+		vpns[i] = base + i % 64;
+		page_table_update(pt, vpns[i], i);
+		total += 1.0 / (i + 1);
+		cdf[i] = total;
+	}
+	for (uint64_t i = 0; i < nlookups; i++) {
+		double u = (double)rand() / RAND_MAX * total;
+		uint64_t lo = 0, hi = npages - 1;
+
+		while (lo < hi) {
+			uint64_t mid = (lo + hi) / 2;
+
+			if (cdf[mid] < u)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		trace[i] = vpns[lo];
+	}
 
-	if (nalloc == NPAGES)
-		errx(1, "out of physical memory");
+	t0 = now();
+	for (uint64_t i = 0; i < nlookups; i++)
+		sum += page_table_query(pt, trace[i]);
+	walk_s = now() - t0;
+
+	tlb_flush();
+	tlb_stats_take();
+	t0 = now();
+	for (uint64_t i = 0; i < nlookups; i++)
+		sum -= tlb_query(pt, trace[i]);
+	cached_s = now() - t0;
+	stats = tlb_stats_take();
+
+	if (sum != 0)
+		errx(1, "cached translations disagree with the page table");
+
+	printf("pages %lu, lookups %lu (zipf)\n", (unsigned long)npages, (unsigned long)nlookups);
+	printf("walk:   %.3f s\n", walk_s);
+	printf("cached: %.3f s (%.2fx)\n", cached_s, walk_s / cached_s);
+	printf("tlb hits %lu misses %lu, psc hits %lu misses %lu\n\n",
+	       (unsigned long)stats.tlb_hits, (unsigned long)stats.tlb_misses,
+	       (unsigned long)stats.psc_hits, (unsigned long)stats.psc_misses);
+
+	free(vpns);
+	free(trace);
+	free(cdf);
+	return 0;
+}
 
-	/* OS memory management isn't really this simple */
-	ppn = nalloc;
-	nalloc++;
+/* Maps and unmaps 'npages' consecutive pages one page at a time, then as one range */
+static int range_bench(uint64_t npages)
+{
+	uint64_t pt = alloc_page_frame();
+	uint64_t vpn = 0x1ffff8000000 >> 12;
+	double t0, single_s, range_s;
+
+	/* Warm up, so both passes find the intermediate nodes in place */
+	page_table_update_range(pt, vpn, npages, 0);
+
+	t0 = now();
+	for (uint64_t i = 0; i < npages; i++)
+		page_table_update(pt, vpn + i, i);
+	for (uint64_t i = 0; i < npages; i++)
+		page_table_update(pt, vpn + i, NO_MAPPING);
+	single_s = now() - t0;
+
+	t0 = now();
+	page_table_update_range(pt, vpn, npages, 0);
+	page_table_update_range(pt, vpn, npages, NO_MAPPING);
+	range_s = now() - t0;
+
+	printf("pages %lu, map + unmap\n", (unsigned long)npages);
+	printf("per page: %.3f s (%.1f Mpages/s)\n", single_s, 2 * npages / single_s / 1e6);
+	printf("range:    %.3f s (%.1f Mpages/s, %.2fx)\n", range_s, 2 * npages / range_s / 1e6, single_s / range_s);
+	return 0;
+}
 
-	va = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	if (va == MAP_FAILED)
-		err(1, "mmap failed");
+struct cpt_worker {
+	pthread_t thread;
+	uint64_t pt;
+	uint64_t id;
+	uint64_t ops;
+	atomic_int *stop;
+};
 
-	pages[ppn] = va;
-	return ppn + 0xbaaaaaad;
+/* Readers check that every translation is either absent or one a writer stored for that VPN */
+static void *cpt_reader(void *arg)
+{
+	struct cpt_worker *w = arg;
+	struct cpt_thread *self = cpt_thread_register();
+	uint64_t x = w->id + 1;
+
+	while (!atomic_load_explicit(w->stop, memory_order_relaxed)) {
+		uint64_t vpn, ppn;
+
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		vpn = (x & 0xffff) << 7;
+		ppn = cpt_query(self, w->pt, vpn);
+		if (ppn != NO_MAPPING && ppn >> 8 != vpn)
+			errx(1, "vpn %lx translated to %lx", (unsigned long)vpn, (unsigned long)ppn);
+		w->ops++;
+	}
+	cpt_thread_unregister(self);
+	return NULL;
 }
 
-void *phys_to_virt(uint64_t phys_addr)
+/* Writers own the VPNs congruent to their id, map them to (vpn << 8 | generation) and unmap them */
+static void *cpt_writer(void *arg)
 {
-	uint64_t ppn = (phys_addr >> 12) - 0xbaaaaaad;
-	uint64_t off = phys_addr & 0xfff;
-	char *va = NULL;
+	struct cpt_worker *w = arg;
+	struct cpt_thread *self = cpt_thread_register();
+	uint64_t x = w->id + 1;
+
+	while (!atomic_load_explicit(w->stop, memory_order_relaxed)) {
+		uint64_t vpn;
+
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		vpn = ((x & 0xffff & ~3ULL) | w->id) << 7;
+		cpt_update(self, w->pt, vpn, x & 1 ? (vpn << 8) | (w->ops & 0xff) : NO_MAPPING);
+		w->ops++;
+	}
+	/* Leave the table empty, so every node but the root must be reclaimed */
+	for (uint64_t v = w->id; v <= 0xffff; v += 4)
+		cpt_update(self, w->pt, v << 7, NO_MAPPING);
+	cpt_thread_unregister(self);
+	return NULL;
+}
 
-	if (ppn < NPAGES)
-		va = pages[ppn] + off;
+/*
+ * Runs 'nreaders' readers and 'nwriters' (at most 4) writers on a fresh
+ * table for 'seconds', prints their throughput and checks that the empty
+ * table gave all its nodes back.
+ */
+static void cpt_run(int nreaders, int nwriters, double seconds)
+{
+	struct cpt_worker w[CPT_MAX_THREADS];
+	atomic_int stop = 0;
+	uint64_t pt = cpt_table_create(), in_use = frames_in_use();
+	uint64_t reads = 0, writes = 0;
+	struct timespec pause = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+	int n = nreaders + nwriters;
+
+	for (int i = 0; i < n; i++) {
+		w[i] = (struct cpt_worker){ .pt = pt, .id = i < nwriters ? i : i + 17, .stop = &stop };
+		if (pthread_create(&w[i].thread, NULL, i < nwriters ? cpt_writer : cpt_reader, &w[i]))
+			errx(1, "pthread_create failed");
+	}
+	nanosleep(&pause, NULL);
+	atomic_store(&stop, 1);
+	for (int i = 0; i < n; i++) {
+		pthread_join(w[i].thread, NULL);
+		if (i < nwriters)
+			writes += w[i].ops;
+		else
+			reads += w[i].ops;
+	}
 
-	return va;
+	cpt_quiesce();
+	if (frames_in_use() != in_use || !cpt_table_empty(pt))
+		errx(1, "empty concurrent page table kept %lu frames",
+		     (unsigned long)(frames_in_use() - in_use));
+	printf("readers %2d writers %d: %7.2f Mlookups/s %6.2f Mupdates/s\n",
+	       nreaders, nwriters, reads / seconds / 1e6, writes / seconds / 1e6);
 }
 
 int main(int argc, char **argv)
 {
+	if (argc > 1 && strcmp(argv[1], "tlb-bench") == 0) {
+		for (uint64_t npages = 1 << 10; npages <= 1 << 16; npages <<= 3)
+			tlb_bench(npages, 1 << 23);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "range-bench") == 0)
+		return range_bench(1 << 22);
+	if (argc > 1 && strcmp(argv[1], "cpt-bench") == 0) {
+		for (int readers = 1; readers <= 16; readers *= 2)
+			cpt_run(readers, 1, 1.0);
+		return 0;
+	}
+
 	uint64_t pt = alloc_page_frame();
 	assert(page_table_query(pt, 0xcafecafeeee) == NO_MAPPING);
 	assert(page_table_query(pt, 0xfffecafeeee) == NO_MAPPING);
@@ -250,6 +435,222 @@ int main(int argc, char **argv)
 	page_table_update(new_pt, 0xabc, NO_MAPPING);
 	printf("zero_not_node_root_Test: PASSED\n");
 
+	// frame_pool_reuse
+	uint64_t frames[FRAMES_PER_ARENA + 1];
+	for (int i = 0; i <= FRAMES_PER_ARENA; i++)
+	{
+		frames[i] = alloc_page_frame();
+		tmp = phys_to_virt(frames[i] << 12);
+		assert(tmp[0] == 0 && tmp[511] == 0);
+		tmp[0] = tmp[511] = frames[i];
+	}
+	for (int i = 0; i <= FRAMES_PER_ARENA; i++)
+	{
+		tmp = phys_to_virt(frames[i] << 12);
+		assert(tmp[0] == frames[i] && tmp[511] == frames[i]);
+	}
+	free_page_frame(frames[7]);
+	assert(alloc_page_frame() == frames[7]);
+	tmp = phys_to_virt(frames[7] << 12);
+	assert(tmp[0] == 0 && tmp[511] == 0);
+	assert(phys_to_virt((frames[FRAMES_PER_ARENA] + 1) << 12) == NULL);
+	printf("frame_pool_reuse: PASSED\n");
+
+	// tlb_coherence
+	pt = alloc_page_frame();
+	tlb_stats_take();
+	assert(tlb_query(pt, 0xabc) == NO_MAPPING);
+	tlb_update(pt, 0xabc, 0x123);
+	tlb_update(pt, 0xabd, 0x456);
+	assert(tlb_query(pt, 0xabc) == 0x123);
+	assert(tlb_query(pt, 0xabc) == 0x123);
+	assert(tlb_query(pt, 0xabd) == 0x456);
+	struct tlb_stats stats = tlb_stats_take();
+	assert(stats.tlb_hits == 1 && stats.psc_hits == 1);
+	tlb_update(pt, 0xabc, 0x789);
+	assert(tlb_query(pt, 0xabc) == 0x789);
+	assert(tlb_query(new_pt, 0xabc) == NO_MAPPING);
+	tlb_update(pt, 0xabc, NO_MAPPING);
+	assert(tlb_query(pt, 0xabc) == NO_MAPPING);
+	assert(tlb_query(pt, 0xabd) == 0x456);
+	tlb_update(pt, 0xabd, NO_MAPPING);
+	assert(tlb_query(pt, 0xabd) == NO_MAPPING);
+	printf("tlb_coherence: PASSED\n");
+
+	// update_range_matches_per_page
+	pt = alloc_page_frame();
+	new_pt = alloc_page_frame();
+	struct { uint64_t vpn, count, ppn; } ranges[] = {
+		{ 0x1fe, 5, 0x100 },		/* crosses a leaf boundary */
+		{ 0x0, 2048, 0x2000 },		/* four whole leaves */
+		{ 0x3ff00, 0x300, 0x7000 },	/* crosses a level 2 boundary */
+		{ 0x100, 0x180, NO_MAPPING },
+		{ 0x3ffff, 1, NO_MAPPING },
+		{ 0xcafe000, 700, NO_MAPPING },	/* nothing mapped there */
+		{ 0x1ff, 3, 0x0 },
+	};
+	for (int r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++)
+	{
+		tlb_query(pt, ranges[r].vpn);
+		page_table_update_range(pt, ranges[r].vpn, ranges[r].count, ranges[r].ppn);
+		for (uint64_t i = 0; i < ranges[r].count; i++)
+			page_table_update(new_pt, ranges[r].vpn + i,
+					  ranges[r].ppn == NO_MAPPING ? NO_MAPPING : ranges[r].ppn + i);
+		assert(tlb_query(pt, ranges[r].vpn) == page_table_query(new_pt, ranges[r].vpn));
+	}
+	for (uint64_t i = 0; i < 0x40200; i++)
+		assert(page_table_query(pt, i) == page_table_query(new_pt, i));
+	printf("update_range_matches_per_page: PASSED\n");
+
+	// mixed_size_mappings
+	pt = alloc_page_frame();
+	uint64_t giga = LEVEL_SPAN(2), mega = LEVEL_SPAN(1);
+	page_table_update(pt, 3 * giga + 5, 0x55);
+	page_table_map_large(pt, 3 * giga, 7 * giga, 2);
+	page_table_map_large(pt, 4 * giga + mega, 0x1234 * mega, 1);
+	tlb_update(pt, 4 * giga + 7, 0x77);
+	int level;
+	assert(page_table_walk(pt, 3 * giga + 12345, &level) && level == 2);
+	assert(page_table_walk(pt, 4 * giga + mega + 1, &level) && level == 1);
+	assert(tlb_query(pt, 3 * giga) == 7 * giga);
+	assert(tlb_query(pt, 3 * giga + 5) == 7 * giga + 5);
+	assert(tlb_query(pt, 4 * giga - 1) == 8 * giga - 1);
+	assert(tlb_query(pt, 4 * giga + mega + 511) == 0x1234 * mega + 511);
+	assert(tlb_query(pt, 4 * giga + 2 * mega) == NO_MAPPING);
+	assert(tlb_query(pt, 4 * giga + 7) == 0x77);
+	/* Uncached lookups see the large leaves too, pt.c's page_table_query would not */
+	assert(page_table_lookup(pt, 3 * giga + 12345) == 7 * giga + 12345);
+	assert(page_table_lookup(pt, 4 * giga + mega + 511) == 0x1234 * mega + 511);
+	assert(page_table_lookup(pt, 4 * giga + 2 * mega) == NO_MAPPING);
+	assert(page_table_lookup(pt, 4 * giga + 7) == 0x77);
+	/* Changes inside large leaves demote them and keep the neighbours */
+	tlb_update(pt, 3 * giga + mega + 3, 0x33);
+	tlb_update(pt, 4 * giga + mega + 9, NO_MAPPING);
+	page_table_update_range(pt, 4 * giga + mega + 500, 20, 0x9000);
+	assert(page_table_walk(pt, 3 * giga + 12345, &level) && level == 1);
+	assert(page_table_walk(pt, 3 * giga + mega, &level) && level == 0);
+	for (uint64_t i = 0; i < 2 * mega; i++)
+	{
+		uint64_t expect = 7 * giga + i;
+
+		if (i == mega + 3)
+			expect = 0x33;
+		assert(tlb_query(pt, 3 * giga + i) == expect);
+		assert(page_table_lookup(pt, 3 * giga + i) == expect);
+		assert(page_table_lookup(pt, 3 * giga + mega + i % mega) ==
+		       tlb_query(pt, 3 * giga + mega + i % mega));
+	}
+	for (uint64_t i = 0; i < mega + 20; i++)
+	{
+		uint64_t expect = i < mega ? 0x1234 * mega + i : NO_MAPPING;
+
+		if (i == 9)
+			expect = NO_MAPPING;
+		else if (i >= 500 && i < 520)
+			expect = 0x9000 + i - 500;
+		assert(tlb_query(pt, 4 * giga + mega + i) == expect);
+		assert(page_table_lookup(pt, 4 * giga + mega + i) == expect);
+	}
+	printf("mixed_size_mappings: PASSED\n");
+
+	// reclaim_empty_nodes
+	pt = alloc_page_frame();
+	uint64_t in_use = frames_in_use();
+	for (int i = 0; i < sizeof(large_addrs) / sizeof(large_addrs[0]); i++)
+		tlb_update(pt, large_addrs[i] >> 12, i);
+	tlb_update(pt, (large_addrs[0] >> 12) + 1, 0x42);
+	assert(frames_in_use() == in_use + 1 + 8 * 3);	/* the level 3 node is shared */
+	for (int i = 0; i < sizeof(large_addrs) / sizeof(large_addrs[0]); i++)
+	{
+		tlb_update(pt, large_addrs[i] >> 12, NO_MAPPING);
+		assert(tlb_query(pt, large_addrs[i] >> 12) == NO_MAPPING);
+	}
+	assert(tlb_query(pt, (large_addrs[0] >> 12) + 1) == 0x42);
+	assert(frames_in_use() == in_use + 4);
+	tlb_update(pt, (large_addrs[0] >> 12) + 1, NO_MAPPING);
+	assert(frames_in_use() == in_use);
+	assert(page_table_walk(pt, large_addrs[0] >> 12, &level) == NULL && level == PT_LEVELS - 1);
+	page_table_update_range(pt, 0x3ff00, 0x300, 0x7000);
+	page_table_update_range(pt, 0x3ff00, 0x300, NO_MAPPING);
+	assert(frames_in_use() == in_use);
+	for (uint64_t i = 0; i < 2048; i++)
+		page_table_update(pt, i, i + 0x2000);
+	for (uint64_t i = 0; i < 2048; i += 2)
+		page_table_update(pt, i, NO_MAPPING);
+	assert(page_table_reclaim(pt) == 0);
+	for (uint64_t i = 1; i < 2048; i += 2)
+		page_table_update(pt, i, NO_MAPPING);
+	assert(page_table_reclaim(pt) == 4 + 3);
+	assert(frames_in_use() == in_use);
+	printf("reclaim_empty_nodes: PASSED\n");
+
+	// reclaim_after_plain_unmap
+	pt = alloc_page_frame();
+	in_use = frames_in_use();
+	for (int i = 0; i < sizeof(large_addrs) / sizeof(large_addrs[0]); i++)
+		page_table_update(pt, large_addrs[i] >> 12, i + 0x10);
+	page_table_update(pt, (large_addrs[0] >> 12) + 1, 0x42);
+	assert(tlb_query(pt, large_addrs[1] >> 12) == 0x11);
+	for (int i = 0; i < sizeof(large_addrs) / sizeof(large_addrs[0]); i++)
+		page_table_update(pt, large_addrs[i] >> 12, NO_MAPPING);
+	/* pt.c's unmaps free nothing, the empty paths wait for page_table_reclaim */
+	assert(frames_in_use() == in_use + 1 + 8 * 3);
+	assert(page_table_reclaim(pt) == 7 * 3);
+	assert(frames_in_use() == in_use + 4);
+	assert(page_table_query(pt, (large_addrs[0] >> 12) + 1) == 0x42);
+	assert(tlb_query(pt, large_addrs[1] >> 12) == NO_MAPPING);
+	page_table_update(pt, large_addrs[1] >> 12, 0x99);
+	assert(tlb_query(pt, large_addrs[1] >> 12) == 0x99);
+	page_table_update(pt, large_addrs[1] >> 12, NO_MAPPING);
+	page_table_update(pt, (large_addrs[0] >> 12) + 1, NO_MAPPING);
+	assert(page_table_reclaim(pt) == 4 + 3);
+	assert(frames_in_use() == in_use);
+	printf("reclaim_after_plain_unmap: PASSED\n");
+
+	// cow_clone_isolation
+	pt = alloc_page_frame();
+	in_use = frames_in_use();
+	page_table_update_range(pt, 0, 1024, 0x2000);
+	for (int i = 0; i < sizeof(large_addrs) / sizeof(large_addrs[0]); i++)
+		tlb_update(pt, large_addrs[i] >> 12, i);
+	uint64_t pt_frames = frames_in_use() - in_use;
+	uint64_t clone = page_table_clone(pt);
+	assert(frames_in_use() == in_use + pt_frames + 1);
+	for (uint64_t i = 0; i < 1024; i++)
+		assert(page_table_query(clone, i) == i + 0x2000);
+	tlb_query(pt, 5);
+	tlb_query(clone, 5);
+	tlb_update(clone, 5, 0x999);
+	assert(frames_in_use() == in_use + pt_frames + 1 + 4);	/* the path below the root */
+	assert(tlb_query(pt, 5) == 0x2005 && tlb_query(clone, 5) == 0x999);
+	assert(tlb_query(pt, 6) == 0x2006 && tlb_query(clone, 6) == 0x2006);
+	tlb_update(pt, large_addrs[0] >> 12, NO_MAPPING);
+	assert(tlb_query(pt, large_addrs[0] >> 12) == NO_MAPPING);
+	assert(tlb_query(clone, large_addrs[0] >> 12) == 0);
+	page_table_update_range(clone, 0, 1024, NO_MAPPING);
+	page_table_map_large(clone, LEVEL_SPAN(1), 0x40000, 1);
+	for (uint64_t i = 0; i < 1024; i++)
+	{
+		assert(page_table_query(pt, i) == i + 0x2000);
+		assert(tlb_query(clone, i) == (i < 512 ? NO_MAPPING : 0x40000 + i - 512));
+		assert(page_table_lookup(clone, i) == tlb_query(clone, i));
+	}
+	for (int i = 1; i < sizeof(large_addrs) / sizeof(large_addrs[0]); i++)
+	{
+		assert(tlb_query(pt, large_addrs[i] >> 12) == i);
+		assert(tlb_query(clone, large_addrs[i] >> 12) == i);
+	}
+	page_table_destroy(clone);
+	for (uint64_t i = 0; i < 1024; i++)
+		assert(page_table_query(pt, i) == i + 0x2000);
+	page_table_destroy(pt);
+	assert(frames_in_use() == in_use - 1);
+	printf("cow_clone_isolation: PASSED\n");
+
+	// concurrent_stress
+	cpt_run(4, 4, 0.2);
+	printf("concurrent_stress: PASSED\n");
+
 	printf("All tests passed successfully!\n");
 
 	return 0;
@@ -0,0 +1,271 @@
+/*
+ * Page table throughput benchmark.
+ *
+ *	gcc -O2 -std=c11 -pthread -o pt_bench pt_bench.c pt_ext.c pt.c
+ *	./pt_bench [-w workload] [-a plain|tlb|range] [-n pages] [-q lookups]
+ *
+ * Every workload maps 'pages' VPNs, runs 'lookups' queries over them and
+ * unmaps them again, on a fresh table. The results go to stdout as a JSON
+ * array with one object per workload: ops/sec and ns/op percentiles per
+ * phase, page table frames and bytes per mapping, frames left after the
+ * unmap, and the peak RSS of the process.
+ *
+ * Percentiles are over batches of BATCH operations (or over one range
+ * call with -a range), timing single operations would mostly measure the
+ * clock.
+ */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "os.h"
+#include "pt_ext.h"
+
+#define BATCH 64
+#define STRIDE 512		/* one mapping per leaf node */
+#define WINDOW (1ULL << 30)	/* VPNs of the random workloads fall in [BASE, BASE + WINDOW) */
+#define BASE (0x1000000ULL)
+#define HIGH_VPN (1ULL << 35)	/* like the 0x1ffff8000000 cases, near the top of the 45-bit VPN space */
+
+enum api { API_PLAIN, API_TLB, API_RANGE };
+
+static const char *api_names[] = { "plain", "tlb", "range" };
+
+struct phase {
+	double seconds;
+	uint64_t ops;
+	double *samples;	/* ns/op of each batch */
+	uint64_t nsamples;
+};
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t next_rand(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return rng;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Fills 'vpns' with the pages a workload maps, in mapping order */
+static void make_vpns(const char *workload, uint64_t *vpns, uint64_t n)
+{
+	for (uint64_t i = 0; i < n; i++) {
+		if (!strcmp(workload, "sequential"))
+			vpns[i] = BASE + i;
+		else if (!strcmp(workload, "strided"))
+			vpns[i] = BASE + i * STRIDE;
+		else if (!strcmp(workload, "sparse-high"))
+			vpns[i] = HIGH_VPN | (next_rand() & (HIGH_VPN - 1));
+		else
+			vpns[i] = BASE + next_rand() % WINDOW;
+	}
+}
+
+/* Fills 'trace' with the indices into 'vpns' a workload queries */
+static void make_trace(const char *workload, uint64_t *trace, uint64_t q, uint64_t n)
+{
+	double *cdf = NULL, total = 0;
+
+	if (!strcmp(workload, "zipf")) {
+		cdf = malloc(n * sizeof(*cdf));
+		if (!cdf)
+			err(1, "malloc failed");
+		for (uint64_t i = 0; i < n; i++) {
+			total += 1.0 / (i + 1);
+			cdf[i] = total;
+		}
+	}
+
+	for (uint64_t i = 0; i < q; i++) {
+		if (cdf) {
+			double u = (double)(next_rand() >> 11) / (1ULL << 53) * total;
+			uint64_t lo = 0, hi = n - 1;
+
+			while (lo < hi) {
+				uint64_t mid = (lo + hi) / 2;
+
+				if (cdf[mid] < u)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			trace[i] = lo;
+		} else if (!strcmp(workload, "sequential") || !strcmp(workload, "strided")) {
+			trace[i] = i % n;
+		} else {
+			trace[i] = next_rand() % n;
+		}
+	}
+	free(cdf);
+}
+
+static void record(struct phase *p, uint64_t ops, double seconds)
+{
+	p->samples[p->nsamples++] = seconds * 1e9 / ops;
+	p->ops += ops;
+	p->seconds += seconds;
+}
+
+/* Maps vpns[i] to i, or unmaps every vpns[i] if 'unmap' */
+static void run_updates(struct phase *p, enum api api, uint64_t pt, const uint64_t *vpns, uint64_t n, int unmap)
+{
+	uint64_t i = 0;
+
+	while (i < n) {
+		uint64_t end = i + BATCH < n ? i + BATCH : n;
+		double t0 = now();
+
+		if (api == API_RANGE) {
+			/* One call per run of consecutive VPNs */
+			for (end = i + 1; end < n && vpns[end] == vpns[end - 1] + 1; end++)
+				;
+			page_table_update_range(pt, vpns[i], end - i, unmap ? NO_MAPPING : i);
+		} else {
+			for (uint64_t j = i; j < end; j++) {
+				if (api == API_TLB)
+					tlb_update(pt, vpns[j], unmap ? NO_MAPPING : j);
+				else
+					page_table_update(pt, vpns[j], unmap ? NO_MAPPING : j);
+			}
+		}
+		record(p, end - i, now() - t0);
+		i = end;
+	}
+}
+
+static uint64_t run_queries(struct phase *p, enum api api, uint64_t pt, const uint64_t *vpns,
+			    const uint64_t *trace, uint64_t q)
+{
+	uint64_t sum = 0;
+
+	for (uint64_t i = 0; i < q; i += BATCH) {
+		uint64_t end = i + BATCH < q ? i + BATCH : q;
+		double t0 = now();
+
+		for (uint64_t j = i; j < end; j++)
+			sum += api == API_TLB ? tlb_query(pt, vpns[trace[j]]) : page_table_query(pt, vpns[trace[j]]);
+		record(p, end - i, now() - t0);
+	}
+	return sum;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void print_phase(const char *name, struct phase *p, int last)
+{
+	qsort(p->samples, p->nsamples, sizeof(*p->samples), cmp_double);
+	printf("    \"%s\": {\"ops\": %lu, \"ops_per_sec\": %.0f, \"ns_p50\": %.1f, \"ns_p90\": %.1f, \"ns_p99\": %.1f}%s\n",
+	       name, (unsigned long)p->ops, p->ops / p->seconds,
+	       p->samples[p->nsamples / 2], p->samples[p->nsamples * 9 / 10], p->samples[p->nsamples * 99 / 100],
+	       last ? "" : ",");
+}
+
+static void bench(const char *workload, enum api api, uint64_t n, uint64_t q, int first)
+{
+	uint64_t *vpns = malloc(n * sizeof(*vpns));
+	uint64_t *trace = malloc(q * sizeof(*trace));
+	struct phase map = { 0 }, query = { 0 }, unmap = { 0 };
+	uint64_t pt, before, frames, left;
+	struct rusage ru;
+	volatile uint64_t sink;
+
+	map.samples = malloc(n * sizeof(double));
+	query.samples = malloc((q / BATCH + 1) * sizeof(double));
+	unmap.samples = malloc(n * sizeof(double));
+	if (!vpns || !trace || !map.samples || !query.samples || !unmap.samples)
+		err(1, "malloc failed");
+
+	make_vpns(workload, vpns, n);
+	make_trace(workload, trace, q, n);
+
+	pt = alloc_page_frame();
+	before = frames_in_use();
+	run_updates(&map, api, pt, vpns, n, 0);
+	frames = frames_in_use() - before;
+	sink = run_queries(&query, api, pt, vpns, trace, q);
+	(void)sink;
+	run_updates(&unmap, api, pt, vpns, n, 1);
+	left = frames_in_use() - before;
+	getrusage(RUSAGE_SELF, &ru);
+
+	printf("%s  {\n", first ? "" : ",\n");
+	printf("    \"workload\": \"%s\", \"api\": \"%s\", \"pages\": %lu, \"lookups\": %lu,\n",
+	       workload, api_names[api], (unsigned long)n, (unsigned long)q);
+	print_phase("map", &map, 0);
+	print_phase("query", &query, 0);
+	print_phase("unmap", &unmap, 0);
+	printf("    \"frames\": %lu, \"pt_bytes_per_mapping\": %.1f, \"frames_after_unmap\": %lu, \"max_rss_kb\": %ld\n  }",
+	       (unsigned long)frames, frames * 4096.0 / n, (unsigned long)left, ru.ru_maxrss);
+
+	free(vpns);
+	free(trace);
+	free(map.samples);
+	free(query.samples);
+	free(unmap.samples);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *workloads[] = { "sequential", "strided", "uniform", "zipf", "sparse-high" };
+	const char *only = NULL;
+	enum api api = API_PLAIN;
+	uint64_t n = 1 << 18, q = 1 << 22;
+	int opt, first = 1;
+
+	while ((opt = getopt(argc, argv, "w:a:n:q:")) != -1) {
+		switch (opt) {
+		case 'w':
+			only = optarg;
+			break;
+		case 'a':
+			for (api = API_PLAIN; api <= API_RANGE && strcmp(optarg, api_names[api]); api++)
+				;
+			if (api > API_RANGE)
+				errx(1, "unknown api %s", optarg);
+			break;
+		case 'n':
+			n = strtoull(optarg, NULL, 0);
+			break;
+		case 'q':
+			q = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			errx(1, "usage: %s [-w workload] [-a plain|tlb|range] [-n pages] [-q lookups]", argv[0]);
+		}
+	}
+	if (n == 0 || q == 0)
+		errx(1, "pages and lookups must be positive");
+
+	printf("[\n");
+	for (int i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+		if (only && strcmp(only, workloads[i]))
+			continue;
+		bench(workloads[i], api, n, q, first);
+		first = 0;
+	}
+	printf("\n]\n");
+	if (first)
+		errx(1, "unknown workload %s", only);
+	return 0;
+}
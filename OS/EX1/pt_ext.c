@@ -0,0 +1,861 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#include "os.h"
+#include "pt_ext.h"
+
+/* 2^20 pages ought to be enough for anybody */
+#define NPAGES (1024 * 1024)
+
+/*
+ * Frames are carved out of 2 MB arenas, one mmap per 512 frames instead of
+ * one per frame. An arena is backed by a huge page when the kernel has one
+ * to spare (or transparent huge pages otherwise), so the page table nodes
+ * of a stress run stay inside few TLB entries.
+ */
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define ARENA_SIZE (FRAMES_PER_ARENA * PAGE_SIZE)
+#define NARENAS (NPAGES / FRAMES_PER_ARENA)
+
+/* Frame numbers handed out start here, so a zero PTE never looks like a real frame */
+#define PPN_BASE 0xbaaaaaad
+
+/*
+ * Per-frame state of the extensions, kept next to the arena's base so it
+ * grows with the pool instead of being sized for NPAGES up front.
+ */
+struct frame_meta {
+	uint32_t sharers;		/* see SHARERS */
+	_Atomic unsigned char state;	/* see NODE_LOCKED */
+};
+
+struct arena {
+	char *va;
+	struct frame_meta *meta;	/* FRAMES_PER_ARENA entries, zeroed */
+};
+
+/*
+ * phys_to_virt takes no lock, so the lock-free readers of the concurrent
+ * page table can call it while a writer allocates: a grown directory is
+ * published atomically and the old one is never freed. An arena's slices
+ * never move, copying the directory keeps them in place.
+ */
+static struct {
+	struct arena *_Atomic arenas;	/* arena index -> base VA and metadata, grown on demand */
+	uint64_t narenas;	/* arenas mapped */
+	uint64_t cap;		/* slots in 'arenas' */
+	_Atomic uint64_t nalloc;	/* frames ever carved out of the arenas */
+	uint64_t *free_list;	/* stack of returned frame numbers */
+	uint64_t nfree;
+	uint64_t free_cap;
+} pool;
+
+static char *map_arena(void)
+{
+	void *va = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+	va = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	if (va == MAP_FAILED) {
+		va = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (va == MAP_FAILED)
+			err(1, "mmap failed");
+#ifdef MADV_HUGEPAGE
+		madvise(va, ARENA_SIZE, MADV_HUGEPAGE);
+#endif
+	}
+	return va;
+}
+
+static void grow_pool(void)
+{
+	if (pool.narenas == NARENAS)
+		errx(1, "out of physical memory");
+
+	if (pool.narenas == pool.cap) {
+		struct arena *arenas = malloc(2 * (pool.cap ? pool.cap : 8) * sizeof(*arenas));
+
+		if (!arenas)
+			err(1, "malloc failed");
+		if (pool.narenas)
+			memcpy(arenas, pool.arenas, pool.narenas * sizeof(*arenas));
+		pool.cap = 2 * (pool.cap ? pool.cap : 8);
+		pool.arenas = arenas;
+	}
+	pool.arenas[pool.narenas].meta = calloc(FRAMES_PER_ARENA, sizeof(struct frame_meta));
+	if (!pool.arenas[pool.narenas].meta)
+		err(1, "calloc failed");
+	pool.arenas[pool.narenas].va = map_arena();
+	pool.narenas++;
+}
+
+uint64_t alloc_page_frame(void)
+{
+	uint64_t ppn;
+
+	/* Recycled frames may hold stale PTEs, fresh ones are zero from mmap */
+	if (pool.nfree) {
+		ppn = pool.free_list[--pool.nfree];
+		memset(phys_to_virt((ppn + PPN_BASE) << PAGE_SHIFT), 0, PAGE_SIZE);
+		return ppn + PPN_BASE;
+	}
+
+	if (pool.nalloc == pool.narenas * FRAMES_PER_ARENA)
+		grow_pool();
+
+	/* OS memory management isn't really this simple */
+	ppn = pool.nalloc;
+	pool.nalloc++;
+
+	return ppn + PPN_BASE;
+}
+
+void free_page_frame(uint64_t frame)
+{
+	uint64_t ppn = frame - PPN_BASE;
+
+	if (ppn >= pool.nalloc)
+		errx(1, "freeing a frame that was never allocated");
+
+	if (pool.nfree == pool.free_cap) {
+		pool.free_cap = pool.free_cap ? pool.free_cap * 2 : 1024;
+		pool.free_list = realloc(pool.free_list, pool.free_cap * sizeof(*pool.free_list));
+		if (!pool.free_list)
+			err(1, "realloc failed");
+	}
+	pool.free_list[pool.nfree++] = ppn;
+}
+
+void *phys_to_virt(uint64_t phys_addr)
+{
+	uint64_t ppn = (phys_addr >> PAGE_SHIFT) - PPN_BASE;
+	uint64_t off = phys_addr & (PAGE_SIZE - 1);
+
+	if (ppn >= pool.nalloc)
+		return NULL;
+
+	return pool.arenas[ppn / FRAMES_PER_ARENA].va + (ppn % FRAMES_PER_ARENA) * PAGE_SIZE + off;
+}
+
+/* The metadata of an allocated 'frame' */
+static struct frame_meta *frame_meta(uint64_t frame)
+{
+	uint64_t ppn = frame - PPN_BASE;
+
+	return &pool.arenas[ppn / FRAMES_PER_ARENA].meta[ppn % FRAMES_PER_ARENA];
+}
+
+/* Frames handed out and not freed, page table nodes included */
+uint64_t frames_in_use(void)
+{
+	return pool.nalloc - pool.nfree;
+}
+
+/*
+ * Copy-on-write sharing between cloned tables: the number of parent entries
+ * pointing at a node beyond the first. 0 means a single table owns it, as
+ * for every node pt.c allocates.
+ */
+#define SHARERS(frame) frame_meta(frame)->sharers
+
+/*
+ * Translation caches in front of page_table_query, for the stress runs.
+ * The TLB caches VPN -> PPN, the paging-structure cache (PSC) caches the
+ * leaf node of a VPN prefix so a TLB miss costs one PTE read instead of a
+ * full walk. Both are 2-way set associative with FIFO replacement; more
+ * ways made the hit path slower than the walk it saves.
+ * Updates must go through tlb_update(); anyone editing PTEs behind its
+ * back must call tlb_flush().
+ */
+#define PTE_VALID 1ULL
+
+/*
+ * A large leaf is an entry of a level 1 or level 2 node that maps a whole
+ * aligned span of 512 or 512 * 512 pages (2 MB / 1 GB) instead of pointing
+ * at a node, marked like x86's PS bit. pt.c does not know the bit and
+ * would follow a large leaf as a node pointer, so a table holding one is
+ * read only through page_table_lookup or tlb_query. Updates through
+ * tlb_update and page_table_update_range demote the large leaf on their
+ * path first, so the pt.c call they make sees ordinary nodes.
+ */
+#define PTE_LARGE (1ULL << 7)
+#define LARGE_LEVEL_MAX 2
+
+#define TLB_SETS 4096
+#define PSC_SETS 256
+#define CACHE_WAYS 2
+
+struct tlb_entry {
+	uint64_t pt;		/* 0 for an empty way, frame numbers never are */
+	uint64_t tag;		/* VPN in the TLB, VPN >> PT_BITS in the PSC */
+	uint64_t val;		/* PPN in the TLB, leaf node VA in the PSC */
+};
+
+struct tlb_set {
+	struct tlb_entry way[CACHE_WAYS];
+	unsigned int next;	/* FIFO victim */
+};
+
+static struct tlb_set tlb[TLB_SETS];
+static struct tlb_set psc[PSC_SETS];
+static struct tlb_stats tlb_stats;
+
+static struct tlb_entry *cache_lookup(struct tlb_set *set, uint64_t pt, uint64_t tag)
+{
+	for (int w = 0; w < CACHE_WAYS; w++)
+		if (set->way[w].pt == pt && set->way[w].tag == tag)
+			return &set->way[w];
+	return NULL;
+}
+
+static void cache_fill(struct tlb_set *set, uint64_t pt, uint64_t tag, uint64_t val)
+{
+	set->way[set->next] = (struct tlb_entry){ .pt = pt, .tag = tag, .val = val };
+	set->next = (set->next + 1) % CACHE_WAYS;
+}
+
+static void cache_invalidate(struct tlb_set *set, uint64_t pt, uint64_t tag)
+{
+	struct tlb_entry *e = cache_lookup(set, pt, tag);
+
+	if (e)
+		e->pt = 0;
+}
+
+static struct tlb_set *tlb_set(uint64_t pt, uint64_t vpn)
+{
+	return &tlb[(vpn ^ vpn >> 8 ^ pt) % TLB_SETS];
+}
+
+static struct tlb_set *psc_set(uint64_t pt, uint64_t prefix)
+{
+	return &psc[(prefix ^ prefix >> 6 ^ pt) % PSC_SETS];
+}
+
+/*
+ * Returns the PTE that translates 'vpn' and the level of the node holding
+ * it, 0 unless the walk stops at a large leaf. NULL if the walk hits an
+ * invalid entry above the leaf level.
+ */
+uint64_t *page_table_walk(uint64_t pt, uint64_t vpn, int *level)
+{
+	uint64_t *node = phys_to_virt(pt << 12);
+
+	for (*level = PT_LEVELS - 1; *level > 0; (*level)--) {
+		uint64_t *pte = &node[(vpn >> (*level * PT_BITS)) & (PT_ENTRIES - 1)];
+
+		if (!(*pte & PTE_VALID))
+			return NULL;
+		if (*pte & PTE_LARGE)
+			return pte;
+		node = phys_to_virt((*pte >> 12) << 12);
+	}
+	return &node[vpn & (PT_ENTRIES - 1)];
+}
+
+/* Same result as page_table_query, for tables that may hold large leaves */
+uint64_t page_table_lookup(uint64_t pt, uint64_t vpn)
+{
+	int level;
+	uint64_t *pte = page_table_walk(pt, vpn, &level);
+
+	if (!pte || !(*pte & PTE_VALID))
+		return NO_MAPPING;
+	return (*pte >> 12) + (vpn & (LEVEL_SPAN(level) - 1));
+}
+
+/* Replaces the large leaf '*pte' of a level 'level' node by a node of 512 smaller leaves */
+static void demote(uint64_t *pte, int level)
+{
+	uint64_t frame = alloc_page_frame();
+	uint64_t *node = phys_to_virt(frame << 12);
+	uint64_t ppn = *pte >> 12;
+	uint64_t flags = level - 1 > 0 ? PTE_VALID | PTE_LARGE : PTE_VALID;
+
+	for (uint64_t i = 0; i < PT_ENTRIES; i++)
+		node[i] = ((ppn + i * LEVEL_SPAN(level - 1)) << 12) | flags;
+	*pte = (frame << 12) | PTE_VALID;
+}
+
+/* Points '*pte' at a private copy of the shared level 'level' node it references */
+static void copy_shared(uint64_t *pte, int level)
+{
+	uint64_t frame = *pte >> 12, copy = alloc_page_frame();
+	uint64_t *node = phys_to_virt(copy << 12);
+
+	memcpy(node, phys_to_virt(frame << 12), PAGE_SIZE);
+	for (int i = 0; level > 0 && i < PT_ENTRIES; i++)
+		if ((node[i] & PTE_VALID) && !(node[i] & PTE_LARGE))
+			SHARERS(node[i] >> 12)++;
+	SHARERS(frame)--;
+	*pte = (copy << 12) | (*pte & (PAGE_SIZE - 1));
+}
+
+/*
+ * Returns the level 'stop' node on the path of 'vpn', ready to be written:
+ * large leaves on the way are demoted and nodes shared with a clone are
+ * copied. A walk that hits an invalid entry returns NULL, or with 'alloc'
+ * links in a fresh node and continues.
+ */
+static uint64_t *walk_to_level(uint64_t pt, uint64_t vpn, int stop, int alloc)
+{
+	uint64_t *node = phys_to_virt(pt << 12);
+
+	for (int level = PT_LEVELS - 1; level > stop; level--) {
+		uint64_t *pte = &node[(vpn >> (level * PT_BITS)) & (PT_ENTRIES - 1)];
+
+		if (!(*pte & PTE_VALID)) {
+			if (!alloc)
+				return NULL;
+			*pte = (alloc_page_frame() << 12) | PTE_VALID;
+		}
+		if (*pte & PTE_LARGE)
+			demote(pte, level);
+		if (SHARERS(*pte >> 12)) {
+			copy_shared(pte, level - 1);
+			/* The cached leaf node is the one the clone keeps */
+			if (level == 1)
+				cache_invalidate(psc_set(pt, vpn >> PT_BITS), pt, vpn >> PT_BITS);
+		}
+		node = phys_to_virt((*pte >> 12) << 12);
+	}
+	return node;
+}
+
+static uint64_t *walk_to_leaf(uint64_t pt, uint64_t vpn, int alloc)
+{
+	return walk_to_level(pt, vpn, 0, alloc);
+}
+
+/*
+ * Returns 1 if no entry of 'node' is valid. Stops at the first live entry,
+ * so only nearly empty nodes cost a full scan.
+ */
+static int node_unused(const uint64_t *node)
+{
+	for (int i = 0; i < PT_ENTRIES; i++)
+		if (node[i] & PTE_VALID)
+			return 0;
+	return 1;
+}
+
+/*
+ * Frees the nodes on the path of 'vpn' that no longer hold a valid entry,
+ * bottom-up, unlinking each from its parent. The root is never freed.
+ *
+ * Occupancy is found by scanning rather than kept in per-node counters:
+ * pt.c writes PTEs the harness never sees, so counters could not be kept
+ * exact.
+ */
+static void reclaim_path(uint64_t pt, uint64_t vpn)
+{
+	uint64_t *ptes[PT_LEVELS];	/* ptes[level]: entry of the level 'level' node on the path */
+	uint64_t *node = phys_to_virt(pt << 12);
+	int level;
+
+	for (level = PT_LEVELS - 1; level > 0; level--) {
+		ptes[level] = &node[(vpn >> (level * PT_BITS)) & (PT_ENTRIES - 1)];
+		if (!(*ptes[level] & PTE_VALID) || (*ptes[level] & PTE_LARGE))
+			return;
+		node = phys_to_virt((*ptes[level] >> 12) << 12);
+	}
+
+	for (level = 1; level < PT_LEVELS; level++) {
+		uint64_t frame = *ptes[level] >> 12;
+
+		if (SHARERS(frame) || !node_unused(phys_to_virt(frame << 12)))
+			break;
+		*ptes[level] = 0;
+		free_page_frame(frame);
+	}
+	if (level > 1)
+		cache_invalidate(psc_set(pt, vpn >> PT_BITS), pt, vpn >> PT_BITS);
+}
+
+uint64_t tlb_query(uint64_t pt, uint64_t vpn)
+{
+	struct tlb_entry *e;
+	uint64_t prefix = vpn >> PT_BITS;
+	uint64_t *leaf, pte, ppn;
+	int level;
+
+	e = cache_lookup(tlb_set(pt, vpn), pt, vpn);
+	if (e) {
+		tlb_stats.tlb_hits++;
+		return e->val;
+	}
+	tlb_stats.tlb_misses++;
+
+	e = cache_lookup(psc_set(pt, prefix), pt, prefix);
+	if (e) {
+		tlb_stats.psc_hits++;
+		leaf = (uint64_t *)(uintptr_t)e->val;
+	} else {
+		tlb_stats.psc_misses++;
+		leaf = page_table_walk(pt, vpn, &level);
+		if (!leaf)
+			return NO_MAPPING;
+		if (level > 0) {
+			/* A large leaf, there is no leaf node to remember */
+			ppn = (*leaf >> 12) + (vpn & (LEVEL_SPAN(level) - 1));
+			cache_fill(tlb_set(pt, vpn), pt, vpn, ppn);
+			return ppn;
+		}
+		leaf -= vpn & (PT_ENTRIES - 1);
+		cache_fill(psc_set(pt, prefix), pt, prefix, (uintptr_t)leaf);
+	}
+
+	/* Only valid translations are cached, a miss on an unmapped VPN always rereads the PTE */
+	pte = leaf[vpn & (PT_ENTRIES - 1)];
+	if (!(pte & PTE_VALID))
+		return NO_MAPPING;
+	ppn = pte >> 12;
+	cache_fill(tlb_set(pt, vpn), pt, vpn, ppn);
+	return ppn;
+}
+
+void tlb_update(uint64_t pt, uint64_t vpn, uint64_t ppn)
+{
+	/* Demotion keeps every translation, the caches stay valid */
+	walk_to_leaf(pt, vpn, 0);
+	page_table_update(pt, vpn, ppn);
+	cache_invalidate(tlb_set(pt, vpn), pt, vpn);
+
+	/* pt.c may free nodes itself; either way the cached leaf node is suspect */
+	if (ppn == NO_MAPPING) {
+		cache_invalidate(psc_set(pt, vpn >> PT_BITS), pt, vpn >> PT_BITS);
+		reclaim_path(pt, vpn);
+	}
+}
+
+void tlb_flush(void)
+{
+	memset(tlb, 0, sizeof(tlb));
+	memset(psc, 0, sizeof(psc));
+}
+
+/* Returns the hit and miss counts of tlb_query since the last call and clears them */
+struct tlb_stats tlb_stats_take(void)
+{
+	struct tlb_stats taken = tlb_stats;
+
+	memset(&tlb_stats, 0, sizeof(tlb_stats));
+	return taken;
+}
+
+/*
+ * Maps 'count' consecutive VPNs from 'vpn' to consecutive PPNs from 'ppn',
+ * or unmaps them all if 'ppn' is NO_MAPPING. Walks once per leaf node and
+ * fills up to 512 PTEs per visit; same results as a page_table_update per
+ * page. Translations cached by tlb_query are invalidated.
+ */
+void page_table_update_range(uint64_t pt, uint64_t vpn, uint64_t count, uint64_t ppn)
+{
+	uint64_t end = vpn + count;
+
+	while (vpn < end) {
+		uint64_t first = vpn & (PT_ENTRIES - 1);
+		uint64_t n = PT_ENTRIES - first;
+		uint64_t *leaf;
+
+		if (n > end - vpn)
+			n = end - vpn;
+
+		/* Unmapping where no leaf exists is a no-op for the whole chunk */
+		leaf = walk_to_leaf(pt, vpn, ppn != NO_MAPPING);
+		if (leaf) {
+			for (uint64_t i = 0; i < n; i++)
+				leaf[first + i] = ppn == NO_MAPPING ? 0 : ((ppn + i) << 12) | PTE_VALID;
+			if (ppn == NO_MAPPING)
+				reclaim_path(pt, vpn);
+		}
+
+		for (uint64_t i = 0; i < n; i++)
+			cache_invalidate(tlb_set(pt, vpn + i), pt, vpn + i);
+		if (ppn == NO_MAPPING)
+			cache_invalidate(psc_set(pt, vpn >> PT_BITS), pt, vpn >> PT_BITS);
+		else
+			ppn += n;
+		vpn += n;
+	}
+}
+
+/* Frees every empty node under the level 'level' node 'node'; returns 1 if 'node' ends up empty */
+static int sweep(uint64_t *node, int level, uint64_t *freed)
+{
+	for (int i = 0; level > 0 && i < PT_ENTRIES; i++) {
+		/* A shared subtree is left to the tables that share it */
+		if (!(node[i] & PTE_VALID) || (node[i] & PTE_LARGE) || SHARERS(node[i] >> 12))
+			continue;
+		if (sweep(phys_to_virt((node[i] >> 12) << 12), level - 1, freed)) {
+			free_page_frame(node[i] >> 12);
+			node[i] = 0;
+			(*freed)++;
+		}
+	}
+	return node_unused(node);
+}
+
+/*
+ * Frees all the empty nodes of 'pt', for tables emptied through pt.c's
+ * page_table_update, which never frees nodes. Returns the frames freed.
+ */
+uint64_t page_table_reclaim(uint64_t pt)
+{
+	uint64_t freed = 0;
+
+	sweep(phys_to_virt(pt << 12), PT_LEVELS - 1, &freed);
+	if (freed)
+		tlb_flush();
+	return freed;
+}
+
+/*
+ * Returns the frame of a level 'level' node and everything under it to the
+ * allocator. A node shared with a clone only loses a sharer.
+ */
+static void free_subtree(uint64_t frame, int level)
+{
+	uint64_t *node = phys_to_virt(frame << 12);
+
+	if (SHARERS(frame)) {
+		SHARERS(frame)--;
+		return;
+	}
+	for (int i = 0; level > 0 && i < PT_ENTRIES; i++)
+		if ((node[i] & PTE_VALID) && !(node[i] & PTE_LARGE))
+			free_subtree(node[i] >> 12, level - 1);
+	free_page_frame(frame);
+}
+
+/*
+ * Maps the LEVEL_SPAN('level') pages from 'vpn' to the pages from 'ppn' with
+ * one large leaf in a level 'level' node, 'level' being 1 (512 pages) or 2
+ * (512 * 512 pages). Both 'vpn' and 'ppn' must be aligned to the span.
+ * Whatever was mapped in the span is replaced and its nodes freed.
+ *
+ * pt.c's page_table_query and page_table_update must not be called on 'pt'
+ * from then on: read it with page_table_lookup or tlb_query and write it
+ * with tlb_update or page_table_update_range.
+ */
+void page_table_map_large(uint64_t pt, uint64_t vpn, uint64_t ppn, int level)
+{
+	uint64_t *node, *pte;
+
+	if (level < 1 || level > LARGE_LEVEL_MAX)
+		errx(1, "no large leaves at level %d", level);
+	if ((vpn | ppn) & (LEVEL_SPAN(level) - 1))
+		errx(1, "large mapping is not aligned");
+
+	node = walk_to_level(pt, vpn, level, 1);
+	pte = &node[(vpn >> (level * PT_BITS)) & (PT_ENTRIES - 1)];
+	if ((*pte & PTE_VALID) && !(*pte & PTE_LARGE))
+		free_subtree(*pte >> 12, level - 1);
+	*pte = (ppn << 12) | PTE_VALID | PTE_LARGE;
+
+	/* Rare enough to drop every cached translation and freed leaf node */
+	tlb_flush();
+}
+
+/*
+ * Returns a new table with the same mappings as 'pt'. Only the root is
+ * copied, in time independent of the number of mappings; everything below
+ * is shared and copied a node at a time when either table first writes
+ * into it. Writes must go through tlb_update or page_table_update_range,
+ * pt.c's page_table_update would write into shared nodes.
+ */
+uint64_t page_table_clone(uint64_t pt)
+{
+	uint64_t clone = alloc_page_frame();
+	uint64_t *node = phys_to_virt(clone << 12);
+
+	memcpy(node, phys_to_virt(pt << 12), PAGE_SIZE);
+	for (int i = 0; i < PT_ENTRIES; i++)
+		if ((node[i] & PTE_VALID) && !(node[i] & PTE_LARGE))
+			SHARERS(node[i] >> 12)++;
+	return clone;
+}
+
+/* Frees 'pt' and every node no other table shares */
+void page_table_destroy(uint64_t pt)
+{
+	free_subtree(pt, PT_LEVELS - 1);
+	tlb_flush();
+}
+
+/*
+ * Concurrent page table, same layout, for many translating threads and a
+ * few remapping ones.
+ *
+ * cpt_query is wait-free: atomic PTE loads inside an epoch critical
+ * section. Writers lock a node (a spin bit per frame) only to install a
+ * child in it, to store a leaf PTE, or to unlink an emptied child; they
+ * hold one lock at a time on the way down and take locks bottom-up while
+ * unlinking, so they cannot deadlock. A node emptied by an unmap is marked
+ * dead, unlinked from its parent and retired; its frame goes back to the
+ * pool once every thread has left the epochs that could still see it.
+ * A writer that finds its node dead starts over from the root.
+ *
+ * Every thread using these calls must register first. Large leaves and
+ * cloned tables are not supported here.
+ */
+#define CPT_RETIRE_BATCH 64
+#define NODE_LOCKED 1
+#define NODE_DEAD 2
+
+struct cpt_thread {
+	_Atomic uint64_t epoch;		/* global epoch seen on entry, 0 when idle */
+	atomic_int used;
+	uint64_t *retired;		/* frames unlinked by this thread ... */
+	uint64_t *retired_epoch;	/* ... and the epoch they were unlinked in */
+	uint64_t nretired;
+	uint64_t retired_cap;
+};
+
+static struct cpt_thread cpt_threads[CPT_MAX_THREADS];
+static _Atomic uint64_t cpt_epoch = 1;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static _Atomic uint64_t *node_va(uint64_t frame)
+{
+	return phys_to_virt(frame << 12);
+}
+
+static void node_lock(uint64_t frame)
+{
+	while (atomic_fetch_or_explicit(&frame_meta(frame)->state, NODE_LOCKED,
+					memory_order_acquire) & NODE_LOCKED)
+		sched_yield();
+}
+
+static void node_unlock(uint64_t frame)
+{
+	atomic_fetch_and_explicit(&frame_meta(frame)->state, ~NODE_LOCKED, memory_order_release);
+}
+
+static int node_dead(uint64_t frame)
+{
+	return atomic_load_explicit(&frame_meta(frame)->state, memory_order_relaxed) & NODE_DEAD;
+}
+
+static int node_empty(_Atomic uint64_t *node)
+{
+	for (int i = 0; i < PT_ENTRIES; i++)
+		if (atomic_load_explicit(&node[i], memory_order_relaxed))
+			return 0;
+	return 1;
+}
+
+static uint64_t cpt_alloc_frame(void)
+{
+	uint64_t frame;
+
+	pthread_mutex_lock(&pool_lock);
+	frame = alloc_page_frame();
+	atomic_store_explicit(&frame_meta(frame)->state, 0, memory_order_relaxed);
+	pthread_mutex_unlock(&pool_lock);
+	return frame;
+}
+
+/* Returns the root of a new, empty concurrent table */
+uint64_t cpt_table_create(void)
+{
+	return cpt_alloc_frame();
+}
+
+/* Returns 1 if the root 'pt' holds no entry, as it must once every mapping is gone */
+int cpt_table_empty(uint64_t pt)
+{
+	return node_empty(node_va(pt));
+}
+
+struct cpt_thread *cpt_thread_register(void)
+{
+	for (int i = 0; i < CPT_MAX_THREADS; i++) {
+		int unused = 0;
+
+		if (atomic_compare_exchange_strong(&cpt_threads[i].used, &unused, 1))
+			return &cpt_threads[i];
+	}
+	errx(1, "too many page table threads");
+}
+
+static void cpt_enter(struct cpt_thread *self)
+{
+	atomic_store(&self->epoch, atomic_load(&cpt_epoch));
+}
+
+static void cpt_exit(struct cpt_thread *self)
+{
+	atomic_store_explicit(&self->epoch, 0, memory_order_release);
+}
+
+/* Frees the frames retired at least two epochs ago, nobody can still hold them */
+static void cpt_reclaim(struct cpt_thread *self)
+{
+	uint64_t epoch = atomic_load(&cpt_epoch), kept = 0;
+
+	pthread_mutex_lock(&pool_lock);
+	for (uint64_t i = 0; i < self->nretired; i++) {
+		if (self->retired_epoch[i] + 2 <= epoch) {
+			free_page_frame(self->retired[i]);
+		} else {
+			self->retired[kept] = self->retired[i];
+			self->retired_epoch[kept++] = self->retired_epoch[i];
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+	self->nretired = kept;
+}
+
+/* Moves the global epoch on if every active thread has caught up with it */
+static void cpt_try_advance(void)
+{
+	uint64_t epoch = atomic_load(&cpt_epoch);
+
+	for (int i = 0; i < CPT_MAX_THREADS; i++) {
+		uint64_t seen = atomic_load(&cpt_threads[i].epoch);
+
+		if (seen && seen != epoch)
+			return;
+	}
+	atomic_compare_exchange_strong(&cpt_epoch, &epoch, epoch + 1);
+}
+
+static void cpt_retire(struct cpt_thread *self, uint64_t frame)
+{
+	if (self->nretired == self->retired_cap) {
+		self->retired_cap = self->retired_cap ? self->retired_cap * 2 : CPT_RETIRE_BATCH;
+		self->retired = realloc(self->retired, self->retired_cap * sizeof(*self->retired));
+		self->retired_epoch = realloc(self->retired_epoch,
+					      self->retired_cap * sizeof(*self->retired_epoch));
+		if (!self->retired || !self->retired_epoch)
+			err(1, "realloc failed");
+	}
+	self->retired[self->nretired] = frame;
+	self->retired_epoch[self->nretired++] = atomic_load(&cpt_epoch);
+
+	if (self->nretired % CPT_RETIRE_BATCH == 0) {
+		cpt_try_advance();
+		cpt_reclaim(self);
+	}
+}
+
+/* Drops the registration; retired frames wait for cpt_quiesce */
+void cpt_thread_unregister(struct cpt_thread *self)
+{
+	cpt_reclaim(self);
+	atomic_store(&self->used, 0);
+}
+
+/* Frees every retired frame. Only safe while no thread is inside a cpt call. */
+void cpt_quiesce(void)
+{
+	atomic_fetch_add(&cpt_epoch, 2);
+	for (int i = 0; i < CPT_MAX_THREADS; i++)
+		cpt_reclaim(&cpt_threads[i]);
+}
+
+uint64_t cpt_query(struct cpt_thread *self, uint64_t pt, uint64_t vpn)
+{
+	_Atomic uint64_t *node = node_va(pt);
+	uint64_t pte = 0;
+
+	cpt_enter(self);
+	for (int level = PT_LEVELS - 1; level >= 0; level--) {
+		pte = atomic_load_explicit(&node[(vpn >> (level * PT_BITS)) & (PT_ENTRIES - 1)],
+					   memory_order_acquire);
+		if (!(pte & PTE_VALID))
+			break;
+		if (level > 0)
+			node = node_va(pte >> 12);
+	}
+	cpt_exit(self);
+
+	return (pte & PTE_VALID) ? pte >> 12 : NO_MAPPING;
+}
+
+/*
+ * Unlinks the empty nodes on the path 'frames' of 'vpn', bottom-up from
+ * the leaf, whose lock the caller holds. Releases every lock it takes.
+ */
+static void cpt_unlink_empty(struct cpt_thread *self, uint64_t *frames, uint64_t vpn)
+{
+	int level;
+
+	for (level = 0; level < PT_LEVELS - 1; level++) {
+		_Atomic uint64_t *parent = node_va(frames[level + 1]);
+
+		if (!node_empty(node_va(frames[level])))
+			break;
+
+		/* A live child keeps its parent non-empty, so the parent is live too */
+		node_lock(frames[level + 1]);
+		atomic_fetch_or_explicit(&frame_meta(frames[level])->state, NODE_DEAD, memory_order_relaxed);
+		atomic_store_explicit(&parent[(vpn >> ((level + 1) * PT_BITS)) & (PT_ENTRIES - 1)], 0,
+				      memory_order_release);
+		node_unlock(frames[level]);
+		cpt_retire(self, frames[level]);
+	}
+	node_unlock(frames[level]);
+}
+
+void cpt_update(struct cpt_thread *self, uint64_t pt, uint64_t vpn, uint64_t ppn)
+{
+	uint64_t frames[PT_LEVELS];	/* frames[level] is the node of that level on the path */
+	_Atomic uint64_t *node, *pte;
+	uint64_t entry;
+
+retry:
+	cpt_enter(self);
+	frames[PT_LEVELS - 1] = pt;
+	for (int level = PT_LEVELS - 1; level > 0; level--) {
+		pte = &node_va(frames[level])[(vpn >> (level * PT_BITS)) & (PT_ENTRIES - 1)];
+		entry = atomic_load_explicit(pte, memory_order_acquire);
+
+		if (!(entry & PTE_VALID)) {
+			if (ppn == NO_MAPPING) {
+				cpt_exit(self);
+				return;
+			}
+			node_lock(frames[level]);
+			if (node_dead(frames[level])) {
+				node_unlock(frames[level]);
+				cpt_exit(self);
+				goto retry;
+			}
+			entry = atomic_load_explicit(pte, memory_order_relaxed);
+			if (!(entry & PTE_VALID)) {
+				entry = (cpt_alloc_frame() << 12) | PTE_VALID;
+				atomic_store_explicit(pte, entry, memory_order_release);
+			}
+			node_unlock(frames[level]);
+		}
+		frames[level - 1] = entry >> 12;
+	}
+
+	node_lock(frames[0]);
+	if (node_dead(frames[0])) {
+		node_unlock(frames[0]);
+		cpt_exit(self);
+		goto retry;
+	}
+	node = node_va(frames[0]);
+	atomic_store_explicit(&node[vpn & (PT_ENTRIES - 1)],
+			      ppn == NO_MAPPING ? 0 : (ppn << 12) | PTE_VALID, memory_order_release);
+	if (ppn == NO_MAPPING)
+		cpt_unlink_empty(self, frames, vpn);
+	else
+		node_unlock(frames[0]);
+	cpt_exit(self);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Extensions on top of os.h: frame recycling, translation caches, range
+ * and large mappings, node reclamation, copy-on-write clones and a
+ * concurrent page table. pt_ext.c implements them together with the
+ * alloc_page_frame and phys_to_virt of os.h; link it with pt.c and a
+ * driver such as os.c (the tests) or pt_bench.c.
+ *
+ * They rely on the page table layout the tests assume: PT_LEVELS levels
+ * of PT_ENTRIES-entry nodes indexed by PT_BITS VPN bits each, valid bit 0
+ * and the next frame number in bits 12 and up.
+ */
+#define PT_LEVELS 5
+#define PT_BITS 9
+#define PT_ENTRIES (1 << PT_BITS)
+
+/* Pages mapped by one entry of a level 'level' node */
+#define LEVEL_SPAN(level) (1ULL << ((level) * PT_BITS))
+
+/* Frames per 2 MB arena of the frame pool */
+#define FRAMES_PER_ARENA 512
+
+/* Frame pool */
+void free_page_frame(uint64_t frame);
+uint64_t frames_in_use(void);
+
+/* Cached translations, see tlb_query in pt_ext.c */
+struct tlb_stats {
+	uint64_t tlb_hits;
+	uint64_t tlb_misses;
+	uint64_t psc_hits;
+	uint64_t psc_misses;
+};
+
+uint64_t tlb_query(uint64_t pt, uint64_t vpn);
+void tlb_update(uint64_t pt, uint64_t vpn, uint64_t ppn);
+void tlb_flush(void);
+struct tlb_stats tlb_stats_take(void);
+
+/*
+ * Bulk and large mappings. pt.c does not understand large leaves: a table
+ * given one by page_table_map_large is read only through page_table_lookup
+ * or tlb_query, never page_table_query.
+ */
+void page_table_update_range(uint64_t pt, uint64_t vpn, uint64_t count, uint64_t ppn);
+void page_table_map_large(uint64_t pt, uint64_t vpn, uint64_t ppn, int level);
+uint64_t page_table_lookup(uint64_t pt, uint64_t vpn);
+uint64_t *page_table_walk(uint64_t pt, uint64_t vpn, int *level);
+
+/*
+ * tlb_update and page_table_update_range free the nodes an unmap empties.
+ * pt.c's page_table_update leaves them in place, and the extensions never
+ * see its writes to count them; page_table_reclaim frees them afterwards.
+ */
+uint64_t page_table_reclaim(uint64_t pt);
+
+/* Copy-on-write clones */
+uint64_t page_table_clone(uint64_t pt);
+void page_table_destroy(uint64_t pt);
+
+/* Concurrent page table, for at most CPT_MAX_THREADS registered threads */
+#define CPT_MAX_THREADS 64
+
+struct cpt_thread;
+uint64_t cpt_table_create(void);
+int cpt_table_empty(uint64_t pt);
+struct cpt_thread *cpt_thread_register(void);
+void cpt_thread_unregister(struct cpt_thread *self);
+void cpt_quiesce(void);
+uint64_t cpt_query(struct cpt_thread *self, uint64_t pt, uint64_t vpn);
+void cpt_update(struct cpt_thread *self, uint64_t pt, uint64_t vpn, uint64_t ppn);
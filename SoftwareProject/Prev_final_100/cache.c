@@ -0,0 +1,562 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "symnmf.h"
+#include "cache.h"
+
+#define FNV_OFFSET 14695981039346656037UL
+#define FNV_PRIME 1099511628211UL
+#define STORE_MAGIC "SYMNMF1"
+#define CACHE_BYTES_ENV "SYMNMF_CACHE_BYTES"
+#define CACHE_DISK_BYTES_ENV "SYMNMF_CACHE_DISK_BYTES"
+#define STORE_PREFIX "symnmf-"
+#define STORE_SUFFIX ".bin"
+
+/*
+ * Header of a disk store file. It is followed by X (N x d), D (N), A (N x N)
+ * and, if 'has_W', W (N x N), all stored row after row.
+ */
+typedef struct store_header
+{
+    char magic[8];
+    long N, d;
+    double scale;
+    long has_W;
+} store_header;
+
+/* LRU list, 'lru_head' is the most recently used entry */
+static cache_entry *lru_head = NULL, *lru_tail = NULL;
+static size_t total_bytes = 0;
+
+/* The last returned entry when it alone exceeds the budget, kept out of the LRU list until released */
+static cache_entry *transient = NULL;
+
+/*
+ * Returns the byte count of the environment variable 'name', 'fallback' when it is unset.
+ */
+static size_t env_bytes(const char *name, const size_t fallback)
+{
+    char *val = getenv(name);
+    if (val == NULL || *val == '\0')
+        return fallback;
+    return (size_t)strtoul(val, NULL, 10);
+}
+
+/*
+ * Folds 'len' bytes of 'data' into the FNV-1a hash 'h'.
+ */
+static unsigned long fnv1a(unsigned long h, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+/*
+ * Returns the content hash of the dataset '*X' together with the similarity kernel parameters.
+ *
+ * 'X' - Address of 2D array with dimensions 'rows' x 'cols'.
+ */
+unsigned long hash_dataset(double ***X, const int rows, const int cols)
+{
+    unsigned long h = FNV_OFFSET;
+    double scale = SYM_KERNEL_SCALE;
+    int i;
+
+    h = fnv1a(h, &rows, sizeof(rows));
+    h = fnv1a(h, &cols, sizeof(cols));
+    h = fnv1a(h, &scale, sizeof(scale));
+    for (i = 0; i < rows; i++)
+        h = fnv1a(h, (*X)[i], cols * sizeof(double));
+    return h;
+}
+
+/*
+ * Returns 1 if 'e' holds the graph of the dataset '*X', 0 otherwise.
+ */
+static int entry_matches(cache_entry *e, unsigned long key, double ***X, const int rows, const int cols)
+{
+    int i;
+    if (e->key != key || e->N != rows || e->d != cols)
+        return 0;
+    for (i = 0; i < rows; i++)
+    {
+        if (memcmp(e->X[i], (*X)[i], cols * sizeof(double)) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Returns the bytes of the X, D, A (and W if 'has_W') of a graph of 'N' points of dimension 'd'.
+ */
+static size_t graph_bytes(const int N, const int d, const int has_W)
+{
+    size_t n = (size_t)N;
+    return (n * d + n + n * n + (has_W ? n * n : 0)) * sizeof(double);
+}
+
+static size_t entry_size(cache_entry *e)
+{
+    return graph_bytes(e->N, e->d, e->W != NULL);
+}
+
+static void lru_unlink(cache_entry *e)
+{
+    if (e->prev != NULL)
+        e->prev->next = e->next;
+    else
+        lru_head = e->next;
+    if (e->next != NULL)
+        e->next->prev = e->prev;
+    else
+        lru_tail = e->prev;
+    e->prev = e->next = NULL;
+    total_bytes -= e->bytes;
+}
+
+static void lru_push_front(cache_entry *e)
+{
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head != NULL)
+        lru_head->prev = e;
+    lru_head = e;
+    if (lru_tail == NULL)
+        lru_tail = e;
+    e->bytes = entry_size(e);
+    total_bytes += e->bytes;
+}
+
+/*
+ * Builds the path of the store file of 'key' inside 'dir' into '*path'.
+ * pre: '*path' is NOT dynamically allocated.
+ * Returns 0 on success.
+ */
+static int store_path(char **path, const char *dir, unsigned long key)
+{
+    size_t len = strlen(dir) + 32;
+    *path = (char *)malloc(len);
+    if (*path == NULL)
+        return 1;
+    sprintf(*path, "%s/symnmf-%016lx.bin", dir, key);
+    return 0;
+}
+
+static int write_rows(FILE *file, double **M, const int rows, const int cols)
+{
+    int i;
+    for (i = 0; i < rows; i++)
+    {
+        if (fwrite(M[i], sizeof(double), cols, file) != (size_t)cols)
+            return 1;
+    }
+    return 0;
+}
+
+/* A file of the disk store, see store_trim */
+typedef struct store_file
+{
+    char *path;
+    size_t bytes;
+    time_t mtime;
+} store_file;
+
+static int older_first(const void *a, const void *b)
+{
+    const store_file *x = (const store_file *)a, *y = (const store_file *)b;
+    return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+
+/*
+ * Removes the least recently used store files of 'dir' (by mtime, which entry_load refreshes) until the
+ * store holds at most 'cap' bytes.
+ */
+static void store_trim(const char *dir, const size_t cap)
+{
+    store_file *files = NULL, *grown;
+    struct dirent *ent;
+    struct stat st;
+    size_t total = 0, len, n = 0, capacity = 0, i;
+    DIR *d = opendir(dir);
+
+    if (d == NULL)
+        return;
+    while ((ent = readdir(d)) != NULL)
+    {
+        len = strlen(ent->d_name);
+        if (strncmp(ent->d_name, STORE_PREFIX, strlen(STORE_PREFIX)) != 0 || len < strlen(STORE_SUFFIX) ||
+            strcmp(ent->d_name + len - strlen(STORE_SUFFIX), STORE_SUFFIX) != 0)
+            continue;
+        if (n == capacity)
+        {
+            capacity = capacity == 0 ? 16 : 2 * capacity;
+            grown = (store_file *)realloc(files, capacity * sizeof(store_file));
+            if (grown == NULL)
+                break;
+            files = grown;
+        }
+        files[n].path = (char *)malloc(strlen(dir) + len + 2);
+        if (files[n].path == NULL)
+            break;
+        sprintf(files[n].path, "%s/%s", dir, ent->d_name);
+        if (stat(files[n].path, &st) != 0)
+        {
+            free(files[n].path);
+            continue;
+        }
+        files[n].bytes = (size_t)st.st_size;
+        files[n].mtime = st.st_mtime;
+        total += files[n++].bytes;
+    }
+    closedir(d);
+
+    qsort(files, n, sizeof(store_file), older_first);
+    for (i = 0; i < n; i++)
+    {
+        if (total > cap && remove(files[i].path) == 0)
+            total -= files[i].bytes;
+        free(files[i].path);
+    }
+    free(files);
+}
+
+/*
+ * Writes 'e' to the disk store if it is enabled and 'e' holds data that is not stored yet.
+ * The file is written under a temporary name and renamed, so concurrent readers never see a partial file.
+ * An entry larger than the store cap is not written; after a write the store is trimmed to its cap.
+ * Returns 0 on success.
+ */
+static int entry_spill(cache_entry *e)
+{
+    char *dir = getenv(CACHE_DIR_ENV), *path, *tmp_path;
+    size_t cap = env_bytes(CACHE_DISK_BYTES_ENV, CACHE_DEFAULT_DISK_BYTES);
+    store_header header;
+    FILE *file;
+    int failed;
+
+    if (dir == NULL || *dir == '\0' || !e->dirty || sizeof(header) + entry_size(e) > cap)
+        return 0;
+    if (store_path(&path, dir, e->key) != 0)
+        return 1;
+    tmp_path = (char *)malloc(strlen(path) + 32);
+    if (tmp_path == NULL)
+    {
+        free(path);
+        return 1;
+    }
+    sprintf(tmp_path, "%s.%ld.tmp", path, (long)getpid());
+
+    file = fopen(tmp_path, "wb");
+    if (file == NULL)
+    {
+        free(path);
+        free(tmp_path);
+        return 1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+    header.N = e->N;
+    header.d = e->d;
+    header.scale = SYM_KERNEL_SCALE;
+    header.has_W = e->W != NULL;
+
+    failed = fwrite(&header, sizeof(header), 1, file) != 1;
+    failed = failed || write_rows(file, e->X, e->N, e->d) != 0;
+    failed = failed || fwrite(e->D, sizeof(double), e->N, file) != (size_t)e->N;
+    failed = failed || write_rows(file, e->A, e->N, e->N) != 0;
+    if (e->W != NULL)
+        failed = failed || write_rows(file, e->W, e->N, e->N) != 0;
+    failed = (fclose(file) != 0) || failed;
+
+    if (failed || rename(tmp_path, path) != 0)
+    {
+        remove(tmp_path);
+        failed = 1;
+    }
+    else
+        e->dirty = 0;
+
+    free(path);
+    free(tmp_path);
+    if (!failed)
+        store_trim(dir, cap);
+    return failed;
+}
+
+/*
+ * Sets '*rows' to 'N' row pointers into the contiguous block 'base'.
+ * Returns 0 on success.
+ */
+static int map_rows(double ***rows, double *base, const int N, const int cols)
+{
+    int i;
+    *rows = (double **)malloc(N * sizeof(double *));
+    if (*rows == NULL)
+        return 1;
+    for (i = 0; i < N; i++)
+        (*rows)[i] = base + (size_t)i * cols;
+    return 0;
+}
+
+static void entry_free(cache_entry *e)
+{
+    if (e->map != NULL)
+    {
+        free(e->X);
+        free(e->A);
+        if (e->W != NULL && e->W_mapped)
+            free(e->W);
+        else if (e->W != NULL)
+            free_2D_array(&e->W, e->N);
+        munmap(e->map, e->map_len);
+    }
+    else
+    {
+        free_2D_array(&e->X, e->N);
+        free_2D_array(&e->A, e->N);
+        free(e->D);
+        if (e->W != NULL)
+            free_2D_array(&e->W, e->N);
+    }
+    free(e);
+}
+
+/*
+ * Maps the store file of 'key' from the disk store into a new entry '*entry'.
+ * Returns 0 on success, 1 if the store is disabled or holds no matching file.
+ */
+static int entry_load(cache_entry **entry, unsigned long key, double ***X, const int rows, const int cols)
+{
+    char *dir = getenv(CACHE_DIR_ENV), *path;
+    store_header *header;
+    struct stat st;
+    size_t N = (size_t)rows, expected;
+    double *data;
+    cache_entry *e;
+    void *map;
+    int fd;
+
+    if (dir == NULL || *dir == '\0')
+        return 1;
+    if (store_path(&path, dir, key) != 0)
+        return 1;
+    fd = open(path, O_RDONLY);
+    /* A use refreshes the mtime, so store_trim drops the least recently used files */
+    if (fd >= 0)
+        utime(path, NULL);
+    free(path);
+    if (fd < 0)
+        return 1;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(store_header))
+    {
+        close(fd);
+        return 1;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 1;
+
+    header = (store_header *)map;
+    expected = sizeof(store_header) + (N * cols + N + N * N + (header->has_W ? N * N : 0)) * sizeof(double);
+    if (memcmp(header->magic, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0 || header->N != rows ||
+        header->d != cols || header->scale != SYM_KERNEL_SCALE || (size_t)st.st_size != expected)
+    {
+        munmap(map, (size_t)st.st_size);
+        return 1;
+    }
+
+    e = (cache_entry *)calloc(1, sizeof(cache_entry));
+    if (e == NULL)
+    {
+        munmap(map, (size_t)st.st_size);
+        return 1;
+    }
+    e->map = map;
+    e->map_len = (size_t)st.st_size;
+    e->key = key;
+    e->N = rows;
+    e->d = cols;
+
+    data = (double *)(header + 1);
+    e->D = data + N * cols;
+    if (map_rows(&e->X, data, rows, cols) != 0 || map_rows(&e->A, e->D + N, rows, rows) != 0 ||
+        (header->has_W && map_rows(&e->W, e->D + N + N * N, rows, rows) != 0))
+    {
+        free(e->X);
+        free(e->A);
+        munmap(map, e->map_len);
+        free(e);
+        return 1;
+    }
+    e->W_mapped = header->has_W != 0;
+
+    if (!entry_matches(e, key, X, rows, cols))
+    {
+        /* Hash collision, the stored graph belongs to another dataset */
+        entry_free(e);
+        return 1;
+    }
+    *entry = e;
+    return 0;
+}
+
+/*
+ * Computes the similarity and degree matrices of '*X' into a new entry '*entry'.
+ * Returns 0 on success.
+ */
+static int entry_compute(cache_entry **entry, unsigned long key, double ***X, const int rows, const int cols)
+{
+    cache_entry *e;
+    int i;
+
+    e = (cache_entry *)calloc(1, sizeof(cache_entry));
+    if (e == NULL)
+        return 1;
+    e->key = key;
+    e->N = rows;
+    e->d = cols;
+    e->dirty = 1;
+
+    if (allocate_2D_array(&e->X, rows, cols) != 0)
+    {
+        free(e);
+        return 1;
+    }
+    for (i = 0; i < rows; i++)
+        memcpy(e->X[i], (*X)[i], cols * sizeof(double));
+
+    if (C_sym(&e->A, X, rows, cols) != 0)
+    {
+        free_2D_array(&e->X, rows);
+        free(e);
+        return 1;
+    }
+    if (C_ddg(&e->D, &e->A, rows) != 0)
+    {
+        free_2D_array(&e->X, rows);
+        free_2D_array(&e->A, rows);
+        free(e);
+        return 1;
+    }
+    *entry = e;
+    return 0;
+}
+
+/*
+ * Evicts least recently used entries until they and 'incoming' more bytes fit the budget, or none is left.
+ * Evicted entries are spilled to the disk store when it is enabled.
+ */
+static void evict_to_budget(const size_t incoming)
+{
+    size_t budget = env_bytes(CACHE_BYTES_ENV, CACHE_DEFAULT_BYTES);
+    cache_entry *victim;
+
+    while (total_bytes + incoming > budget && lru_tail != NULL)
+    {
+        victim = lru_tail;
+        lru_unlink(victim);
+        entry_spill(victim);
+        entry_free(victim);
+    }
+}
+
+/*
+ * Finds the similarity graph of the dataset '*X' and place it in '*entry'.
+ * The graph is taken from memory, then from the disk store (SYMNMF_CACHE_DIR), and is computed on a miss.
+ * Room for it is made before it is loaded or computed. An entry larger than the whole budget is not kept:
+ * it is handed out alone and freed by 'cache_release'.
+ * The returned entry stays valid until the next call to 'cache_get', 'cache_release' or 'cache_clear'.
+ * Returns 0 on success.
+ *
+ * 'X' - Address of 2D matrix that contains 'rows' vectors, each having a size of 'cols'.
+ * 'need_W' - 1 if the normalized similarity matrix 'W' of the entry is needed, 0 otherwise.
+ */
+int cache_get(cache_entry **entry, double ***X, const int rows, const int cols, const int need_W)
+{
+    unsigned long key = hash_dataset(X, rows, cols);
+    cache_entry *e;
+
+    cache_release(transient);
+    for (e = lru_head; e != NULL; e = e->next)
+    {
+        if (entry_matches(e, key, X, rows, cols))
+            break;
+    }
+
+    if (e != NULL)
+    {
+        lru_unlink(e);
+        evict_to_budget(graph_bytes(rows, cols, need_W || e->W != NULL));
+    }
+    else
+    {
+        evict_to_budget(graph_bytes(rows, cols, need_W));
+        if (entry_load(&e, key, X, rows, cols) != 0 && entry_compute(&e, key, X, rows, cols) != 0)
+            return 1;
+    }
+
+    if (need_W && e->W == NULL)
+    {
+        if (C_norm(&e->W, &e->D, &e->A, rows) != 0)
+        {
+            e->W = NULL;
+            entry_free(e);
+            return 1;
+        }
+        e->W_mapped = 0;
+        e->dirty = 1;
+    }
+
+    if (entry_size(e) > env_bytes(CACHE_BYTES_ENV, CACHE_DEFAULT_BYTES))
+        transient = e;
+    else
+        lru_push_front(e);
+    *entry = e;
+    return 0;
+}
+
+/*
+ * Frees 'entry' now if it was handed out without being kept in the cache, spilling it to the disk store
+ * when enabled. Entries kept in the cache, and NULL, are left alone.
+ */
+void cache_release(cache_entry *entry)
+{
+    if (entry == NULL || entry != transient)
+        return;
+    transient = NULL;
+    entry_spill(entry);
+    entry_free(entry);
+}
+
+/*
+ * Spills every cached entry to the disk store (if enabled) and frees the in-memory cache.
+ */
+void cache_clear(void)
+{
+    cache_entry *e;
+    cache_release(transient);
+    while (lru_head != NULL)
+    {
+        e = lru_head;
+        lru_unlink(e);
+        entry_spill(e);
+        entry_free(e);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+/* Directory of the disk store, the cache stays in memory only when unset */
+#define CACHE_DIR_ENV "SYMNMF_CACHE_DIR"
+
+/* Default in-memory budget of the cache, overridden by SYMNMF_CACHE_BYTES */
+#define CACHE_DEFAULT_BYTES (256UL * 1024UL * 1024UL)
+
+/* Default size cap of the disk store, overridden by SYMNMF_CACHE_DISK_BYTES; the oldest files go first */
+#define CACHE_DEFAULT_DISK_BYTES (1024UL * 1024UL * 1024UL)
+
+/*
+ * A cached similarity graph of one dataset X.
+ * 'A', 'D' and 'W' are owned by the cache and must NOT be freed by the caller.
+ * 'W' is NULL until it was requested once.
+ */
+typedef struct cache_entry
+{
+    unsigned long key;
+    int N, d;
+    double **X, **A, *D, **W;
+    size_t bytes;
+    int dirty;
+
+    /* Non NULL when X, A, D (and W if 'W_mapped') live in a read-only mapping of the disk store */
+    void *map;
+    size_t map_len;
+    int W_mapped;
+
+    struct cache_entry *prev, *next;
+} cache_entry;
+
+unsigned long hash_dataset(double ***X, const int rows, const int cols);
+
+int cache_get(cache_entry **entry, double ***X, const int rows, const int cols, const int need_W);
+
+void cache_release(cache_entry *entry);
+
+void cache_clear(void);
+
+#endif
@@ -0,0 +1,431 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symnmf.h"
+#include "dedup.h"
+#include "kernels.h"
+#include "isa.h"
+
+/*
+ * Duplicate compression. Rows of X are hashed into groups of equal rows, or with a quantum q > 0 of equal
+ * rows once every coordinate is rounded to a multiple of q, and each group becomes one unique point with
+ * the group size as its weight. The similarity, degree and update math then runs on the n unique points:
+ * copies of a point have equal rows in A and W and get equal rows of H, so every N x N sum collapses into
+ * an n x n one weighted by the group sizes. Results are expanded back to the original order on output.
+ *
+ * With q == 0 the unique points are the rows themselves and the expanded matrices hold the same values as the
+ * uncompressed ones, up to the order of the degree sums. With q > 0 a unique point is the mean of its group;
+ * near duplicates on either side of a grid line stay apart.
+ */
+
+/*
+ * Returns coordinate 'x' as hashed and compared: itself, or its grid cell for 'quantum' > 0.
+ * Adding 0 turns -0 into 0, equal under == but not under the hash.
+ */
+static double key(const double x, const double quantum)
+{
+    return (quantum > 0 ? floor(x / quantum + 0.5) : x) + 0.0;
+}
+
+/*
+ * Returns the FNV-1a hash of the key of 'row' (length 'd').
+ */
+static unsigned long hash_row(const double *row, const int d, const double quantum)
+{
+    unsigned long h = 2166136261UL;
+    unsigned char bytes[sizeof(double)];
+    double k;
+    int l;
+    size_t b;
+    for (l = 0; l < d; l++)
+    {
+        k = key(row[l], quantum);
+        memcpy(bytes, &k, sizeof(double));
+        for (b = 0; b < sizeof(double); b++)
+            h = (h ^ bytes[b]) * 16777619UL;
+    }
+    return h;
+}
+
+/*
+ * Returns 1 if 'x' and 'y' (length 'd') have the same key.
+ */
+static int same_key(const double *x, const double *y, const int d, const double quantum)
+{
+    int l;
+    for (l = 0; l < d; l++)
+    {
+        if (key(x[l], quantum) != key(y[l], quantum))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Collapse the duplicate rows of X into the unique points '*U' and the map '*map' from X to them.
+ * Unique points are numbered in the order of their first occurrence in X.
+ * pre: '*U' is NOT dynamically allocated.
+ * Returns 0 on success, 1 also for a negative (or NaN) 'quantum'.
+ *
+ * 'X' - Address of 2D matrix that contains 'rows_X' vectors, each having a size of 'cols_X'.
+ * 'quantum' - Grid of the near duplicates, 0 for exact duplicates only.
+ */
+int C_dedup(double ***U, dedup_map *map, double ***X, const int rows_X, const int cols_X, const double quantum)
+{
+    int *table, *first, i, u, l, n = 0;
+    unsigned long size = 2, slot;
+
+    if (!(quantum >= 0))
+        return 1;
+    while (size < 2 * (unsigned long)rows_X)
+        size *= 2;
+    table = (int *)malloc(size * sizeof(int));
+    first = (int *)malloc(rows_X * sizeof(int));
+    map->group = (int *)malloc(rows_X * sizeof(int));
+    map->weight = (double *)calloc(rows_X, sizeof(double));
+    if (table == NULL || first == NULL || map->group == NULL || map->weight == NULL)
+    {
+        free(table);
+        free(first);
+        free_dedup(map);
+        return 1;
+    }
+
+    /* Open addressing with linear probing, slots hold unique point numbers or -1 */
+    for (slot = 0; slot < size; slot++)
+        table[slot] = -1;
+    for (i = 0; i < rows_X; i++)
+    {
+        slot = hash_row((*X)[i], cols_X, quantum) & (size - 1);
+        while (table[slot] >= 0 && !same_key((*X)[first[table[slot]]], (*X)[i], cols_X, quantum))
+            slot = (slot + 1) & (size - 1);
+        if (table[slot] < 0)
+        {
+            first[n] = i;
+            table[slot] = n++;
+        }
+        map->group[i] = table[slot];
+        map->weight[table[slot]]++;
+    }
+    free(table);
+    map->N = rows_X;
+    map->n = n;
+
+    if (allocate_2D_array(U, n, cols_X) != 0)
+    {
+        free(first);
+        free_dedup(map);
+        return 1;
+    }
+    for (u = 0; u < n && quantum == 0; u++)
+        memcpy((*U)[u], (*X)[first[u]], cols_X * sizeof(double));
+    if (quantum > 0)
+    {
+        for (i = 0; i < rows_X; i++)
+        {
+            for (l = 0; l < cols_X; l++)
+                (*U)[map->group[i]][l] += (*X)[i][l] / map->weight[map->group[i]];
+        }
+    }
+
+    free(first);
+    return 0;
+}
+
+/*
+ * Calculate the similarity row of unique point 'u' against every unique point into 'row'.
+ * Copies of a point are at distance 0, so the diagonal entry is 1, the similarity between two copies.
+ */
+static void unique_row(double *row, double ***U, const int cols_U, const int n, const int u,
+                       const isa_kernels *isa)
+{
+    int v;
+    for (v = 0; v < n; v++)
+        row[v] = exp(-SYM_KERNEL_SCALE * isa->dist2((*U)[u], (*U)[v], cols_U));
+}
+
+/*
+ * Calculate the degrees '*D' of the unique points: d_u = sum over v of weight_v * s_uv, less the 1 of u itself.
+ * pre: '*D' is NOT dynamically allocated.
+ * Returns 0 on success.
+ */
+static int weighted_degrees(double **D, double ***U, const int cols_U, dedup_map *map)
+{
+    const isa_kernels *isa = isa_select();
+    double *row;
+    int u, v;
+
+    *D = (double *)malloc(map->n * sizeof(double));
+    row = (double *)malloc(map->n * sizeof(double));
+    if (*D == NULL || row == NULL)
+    {
+        free(*D);
+        free(row);
+        return 1;
+    }
+    for (u = 0; u < map->n; u++)
+    {
+        unique_row(row, U, cols_U, map->n, u, isa);
+        (*D)[u] = -1;
+        for (v = 0; v < map->n; v++)
+            (*D)[u] += map->weight[v] * row[v];
+    }
+    free(row);
+    return 0;
+}
+
+/*
+ * Calculate the weighted normalized similarity matrix '*W' of the unique points, the n x n matrix for which
+ * (W * H)_u over the unique points equals (W * H)_i over the original points for every copy i of u when the
+ * copies share their H row: w_uv = weight_v * s_uv / sqrt(d_u * d_v), and w_uu = (weight_u - 1) / d_u for
+ * the other copies of u. It is not symmetric unless all weights are equal.
+ * pre: '*W' is NOT dynamically allocated.
+ * Returns 0 on success.
+ *
+ * 'U' - Address of the 'map->n' unique points, each having a size of 'cols_U'.
+ */
+int C_dedup_norm(double ***W, double ***U, const int cols_U, dedup_map *map)
+{
+    const isa_kernels *isa = isa_select();
+    double *P, s_uv;
+    int u, v, n = map->n;
+
+    P = (double *)malloc(n * sizeof(double));
+    if (P == NULL || allocate_2D_array(W, n, n) != 0)
+    {
+        free(P);
+        return 1;
+    }
+
+    /* The similarity of the unique points is symmetric, as in C_sym each pair is formed once */
+    for (u = 0; u < n; u++)
+    {
+        (*W)[u][u] = 1;
+        for (v = u + 1; v < n; v++)
+        {
+            s_uv = exp(-SYM_KERNEL_SCALE * isa->dist2((*U)[u], (*U)[v], cols_U));
+            (*W)[u][v] = s_uv;
+            (*W)[v][u] = s_uv;
+        }
+    }
+    for (u = 0; u < n; u++)
+    {
+        P[u] = -1;
+        for (v = 0; v < n; v++)
+            P[u] += map->weight[v] * (*W)[u][v];
+        P[u] = 1 / sqrt(P[u]);
+    }
+    for (u = 0; u < n; u++)
+    {
+        for (v = 0; v < n; v++)
+            (*W)[u][v] *= (v == u ? map->weight[u] - 1 : map->weight[v]) * P[u] * P[v];
+    }
+
+    free(P);
+    return 0;
+}
+
+/*
+ * Returns the mean entry of the original N x N normalized similarity matrix, from its weighted form '*W'.
+ */
+double dedup_mean(double ***W, dedup_map *map)
+{
+    double total = 0;
+    int u, v;
+    for (u = 0; u < map->n; u++)
+    {
+        for (v = 0; v < map->n; v++)
+            total += map->weight[u] * (*W)[u][v];
+    }
+    return total / ((double)map->N * map->N);
+}
+
+/*
+ * Calculate the optimal 'H_out' matrix of the unique points from the initial 'H_in' for the weighted '*W' of
+ * C_dedup_norm. Both the Gram matrix H^T * H and the convergence residual sum over the original points,
+ * every unique row counted 'weight' times, so the iterates are those of C_symnmf on the original points
+ * started from an H with equal rows for the copies.
+ * pre: '*H_out' is NOT dynamically allocated.
+ * Returns 0 on success.
+ *
+ * 'H_out', 'H_in' - Address of a 2D array with dimensions 'map->n' x 'cols_H'.
+ */
+int C_symnmf_weighted(double ***H_out, double ***H_in, const int cols_H, double ***W, dedup_map *map)
+{
+    const symnmf_kernels *kernels = select_kernels(cols_H);
+    double **G, *HtH, diff, delta, root;
+    int iter, u, c, n = map->n;
+
+    HtH = (double *)malloc(cols_H * cols_H * sizeof(double));
+    if (HtH == NULL)
+        return 1;
+    if (allocate_2D_array(&G, n, cols_H) != 0)
+    {
+        free(HtH);
+        return 1;
+    }
+    if (allocate_2D_array(H_out, n, cols_H) != 0)
+    {
+        free(HtH);
+        free_2D_array(&G, n);
+        return 1;
+    }
+
+    delta = EPS + 1;
+    for (iter = 0; iter < MAX_ITER && delta >= EPS; iter++)
+    {
+        /* sum over u of weight_u * h_u * h_u^T is the Gram matrix of the rows sqrt(weight_u) * h_u */
+        for (u = 0; u < n; u++)
+        {
+            root = sqrt(map->weight[u]);
+            for (c = 0; c < cols_H; c++)
+                G[u][c] = root * (*H_in)[u][c];
+        }
+        kernels->gram(HtH, G, n, cols_H);
+        if (kernels->update_rows(*H_out, *W, *H_in, n, HtH, 0, n, cols_H, BETA, NULL) != 0)
+        {
+            /* Division by zero */
+            free(HtH);
+            free_2D_array(&G, n);
+            free_2D_array(H_out, n);
+            return 1;
+        }
+
+        delta = 0;
+        for (u = 0; u < n; u++)
+        {
+            for (c = 0; c < cols_H; c++)
+            {
+                diff = (*H_out)[u][c] - (*H_in)[u][c];
+                delta += map->weight[u] * diff * diff;
+            }
+        }
+        copy_matrix(H_in, H_out, n, cols_H);
+    }
+
+    free(HtH);
+    free_2D_array(&G, n);
+    return 0;
+}
+
+/*
+ * Expand the rows of the unique points '*M_in' to the original points: row i of '*M_out' is row group[i].
+ * pre: '*M_out' is NOT dynamically allocated.
+ * Returns 0 on success.
+ *
+ * 'M_in' - Address of a 2D array with dimensions 'map->n' x 'cols'.
+ */
+int expand_rows(double ***M_out, double ***M_in, const int cols, dedup_map *map)
+{
+    int i;
+    if (allocate_2D_array(M_out, map->N, cols) != 0)
+        return 1;
+    for (i = 0; i < map->N; i++)
+        memcpy((*M_out)[i], (*M_in)[map->group[i]], cols * sizeof(double));
+    return 0;
+}
+
+/* Which matrix dedup_print prints */
+#define PRINT_SYM 0
+#define PRINT_DDG 1
+#define PRINT_NORM 2
+
+/*
+ * Print the sym, ddg or norm matrix of X row by row from its unique points. The similarity row of a unique
+ * point is formed once per run of its copies in X and expanded, so the exponentials cost O(N * n), and the
+ * degrees O(n^2), instead of O(N^2).
+ * Returns 0 on success.
+ */
+static int dedup_print(double ***X, const int rows_X, const int cols_X, const double quantum, const int what)
+{
+    const isa_kernels *isa = isa_select();
+    double **U, *D = NULL, *P = NULL, *urow, *row;
+    dedup_map map;
+    int i, j, u = -1, failed = 0;
+
+    if (C_dedup(&U, &map, X, rows_X, cols_X, quantum) != 0)
+        return 1;
+    urow = (double *)malloc(map.n * sizeof(double));
+    row = (double *)calloc(rows_X, sizeof(double));
+    P = (double *)malloc(rows_X * sizeof(double));
+    if (urow == NULL || row == NULL || P == NULL ||
+        (what != PRINT_SYM && weighted_degrees(&D, &U, cols_X, &map) != 0))
+    {
+        failed = 1;
+        D = NULL;
+    }
+
+    /* As in stream_norm, P = D^(-1/2) and w_ij = (a_ij * p_j) * p_i */
+    for (i = 0; !failed && what == PRINT_NORM && i < rows_X; i++)
+        P[i] = 1 / sqrt(D[map.group[i]]);
+    for (i = 0; !failed && i < rows_X; i++)
+    {
+        if (what == PRINT_DDG)
+        {
+            row[i] = D[map.group[i]];
+            print_row(row, rows_X);
+            row[i] = 0;
+            continue;
+        }
+        if (map.group[i] != u)
+        {
+            u = map.group[i];
+            unique_row(urow, &U, cols_X, map.n, u, isa);
+        }
+        for (j = 0; j < rows_X; j++)
+            row[j] = urow[map.group[j]];
+        row[i] = 0;
+        if (what == PRINT_NORM)
+            isa->scale_row(row, row, P, P[i], rows_X);
+        print_row(row, rows_X);
+    }
+
+    free(urow);
+    free(row);
+    free(P);
+    free(D);
+    free_2D_array(&U, map.n);
+    free_dedup(&map);
+    return failed;
+}
+
+/*
+ * Print the similarity matrix of X row by row, computed on its unique points.
+ * Returns 0 on success.
+ *
+ * 'X' - Address of 2D matrix that contains 'rows_X' vectors, each having a size of 'cols_X'.
+ * 'quantum' - Grid of the near duplicates, 0 for exact duplicates only.
+ */
+int dedup_sym(double ***X, const int rows_X, const int cols_X, const double quantum)
+{
+    return dedup_print(X, rows_X, cols_X, quantum, PRINT_SYM);
+}
+
+/*
+ * Print the diagonal degree matrix of X row by row, computed on its unique points.
+ * Returns 0 on success.
+ */
+int dedup_ddg(double ***X, const int rows_X, const int cols_X, const double quantum)
+{
+    return dedup_print(X, rows_X, cols_X, quantum, PRINT_DDG);
+}
+
+/*
+ * Print the normalized similarity matrix of X row by row, computed on its unique points.
+ * Returns 0 on success.
+ */
+int dedup_norm(double ***X, const int rows_X, const int cols_X, const double quantum)
+{
+    return dedup_print(X, rows_X, cols_X, quantum, PRINT_NORM);
+}
+
+/*
+ * Free the dynamic memory of '*map'.
+ */
+void free_dedup(dedup_map *map)
+{
+    free(map->group);
+    free(map->weight);
+    map->group = NULL;
+    map->weight = NULL;
+}
@@ -0,0 +1,40 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+/*
+ * Duplicate compression of the streaming CLI goals: unset for none, else the quantum of the near duplicate
+ * grid (see C_dedup), "0" for exact duplicates only. A value that is not a nonnegative number is an error,
+ * and so is setting it together with SYMNMF_CACHE_DIR, whose cache holds full graphs only.
+ */
+#define DEDUP_ENV "SYMNMF_DEDUP"
+
+/*
+ * 'N' original points collapsed into 'n' unique points.
+ * Original point 'i' is unique point 'group[i]', which stands for 'weight[group[i]]' original points.
+ */
+typedef struct dedup_map
+{
+    int N, n;
+    int *group;
+    double *weight;
+} dedup_map;
+
+int C_dedup(double ***U, dedup_map *map, double ***X, const int rows_X, const int cols_X, const double quantum);
+
+int C_dedup_norm(double ***W, double ***U, const int cols_U, dedup_map *map);
+
+double dedup_mean(double ***W, dedup_map *map);
+
+int C_symnmf_weighted(double ***H_out, double ***H_in, const int cols_H, double ***W, dedup_map *map);
+
+int expand_rows(double ***M_out, double ***M_in, const int cols, dedup_map *map);
+
+int dedup_sym(double ***X, const int rows_X, const int cols_X, const double quantum);
+
+int dedup_ddg(double ***X, const int rows_X, const int cols_X, const double quantum);
+
+int dedup_norm(double ***X, const int rows_X, const int cols_X, const double quantum);
+
+void free_dedup(dedup_map *map);
+
+#endif
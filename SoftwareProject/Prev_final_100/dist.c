@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <string.h>
+#include "symnmf.h"
+#include "dist.h"
+#include "kernels.h"
+#include "placement.h"
+
+/*
+ * Row-partitioned SymNMF engine.
+ * Every worker keeps a full replica of H but only updates the rows it owns, reading only its own
+ * row panel of W. Per iteration the workers exchange the k x k partial sums of H^T * H (together
+ * with the partial delta norm) and the updated H rows, nothing else.
+ */
+
+/*
+ * Runs the SymNMF iterations of worker 't->rank' on the replicated matrix '*H', which is
+ * updated in place and is identical in all workers on return.
+ * Returns 0 on success, 1 if any worker failed (division by zero).
+ *
+ * 'H' - Address of a 2D array with dimensions 'rows_H' x 'cols_H'.
+ * 'W' - Address of a 2D array with dimensions 'N_W' x 'N_W'. Only the rows owned by the worker are read.
+ */
+int symnmf_partitioned(transport *t, double ***H, const int rows_H, const int cols_H, double ***W, const int N_W)
+{
+    const symnmf_kernels *kernels = select_kernels(cols_H);
+    int lo, hi, i, l, c, iter, k2, failed;
+    double diff, *reduce, *HtH, **H_new;
+
+    lo = (int)((long)t->rank * rows_H / t->size);
+    hi = (int)((long)(t->rank + 1) * rows_H / t->size);
+    k2 = cols_H * cols_H;
+
+    /* Forked workers run next to their panel of W, rank 0 is the caller and keeps its CPUs */
+    if (t->rank != 0)
+        placement_bind_rows(lo, rows_H);
+
+    /* reduce = [partial H^T * H (k x k), partial delta norm, failure flag] */
+    reduce = (double *)calloc(k2 + 2, sizeof(double));
+    if (reduce == NULL)
+        return 1;
+    HtH = (double *)malloc(k2 * sizeof(double));
+    if (HtH == NULL)
+    {
+        free(reduce);
+        return 1;
+    }
+    if (allocate_2D_array(&H_new, rows_H, cols_H) != 0)
+    {
+        free(reduce);
+        free(HtH);
+        return 1;
+    }
+
+    /* Initial H^T * H from the owned rows */
+    kernels->gram(reduce, *H + lo, hi - lo, cols_H);
+    failed = t->allreduce_sum(t, reduce, k2 + 2) != 0;
+
+    for (iter = 0; iter < MAX_ITER && !failed; iter++)
+    {
+        memcpy(HtH, reduce, k2 * sizeof(double));
+        memset(reduce, 0, (k2 + 2) * sizeof(double));
+
+        if (kernels->update_rows(H_new + lo, *W, *H, N_W, HtH, lo, hi, cols_H, BETA, NULL) != 0)
+        {
+            /* Division by zero, reported to all workers by the next reduction */
+            reduce[k2 + 1] = 1;
+        }
+        for (i = lo; i < hi && reduce[k2 + 1] == 0; i++)
+        {
+            for (c = 0; c < cols_H; c++)
+            {
+                diff = H_new[i][c] - (*H)[i][c];
+                reduce[k2] += diff * diff;
+            }
+            for (l = 0; l < cols_H; l++)
+            {
+                for (c = 0; c < cols_H; c++)
+                    reduce[l * cols_H + c] += H_new[i][l] * H_new[i][c];
+            }
+        }
+
+        if (t->allreduce_sum(t, reduce, k2 + 2) != 0 || reduce[k2 + 1] != 0)
+        {
+            failed = 1;
+            break;
+        }
+        for (i = lo; i < hi; i++)
+            memcpy((*H)[i], H_new[i], cols_H * sizeof(double));
+        if (t->allgather_rows(t, *H, lo, hi, cols_H) != 0)
+        {
+            failed = 1;
+            break;
+        }
+        if (reduce[k2] < EPS)
+            break;
+    }
+
+    free(reduce);
+    free(HtH);
+    free_2D_array(&H_new, rows_H);
+    return failed;
+}
+
+/*
+ * Calculate the optimal 'H_out' matrix from the initial 'H_in' with 'workers' processes,
+ * each owning a row partition of W and H, connected by 'backend'.
+ * pre: '*H_out' is NOT dynamically allocated.
+ * Returns 0 on success.
+ *
+ * 'H_out', 'H_in' - Address of a 2D array with dimensions 'rows_H' x 'cols_H'.
+ * 'W' - Address of a 2D array with dimensions 'N_W' x 'N_W'.
+ */
+int C_symnmf_distributed(double ***H_out, double ***H_in, const int rows_H, const int cols_H,
+                         double ***W, const int N_W, const int workers, const transport_backend *backend)
+{
+    transport *t;
+    int i, failed;
+
+    if (workers < 1 || workers > rows_H)
+        return 1;
+    if (allocate_2D_array(H_out, rows_H, cols_H) != 0)
+        return 1;
+    for (i = 0; i < rows_H; i++)
+        memcpy((*H_out)[i], (*H_in)[i], cols_H * sizeof(double));
+
+    if (backend->launch(&t, workers, rows_H, cols_H, cols_H * cols_H + 2) != 0)
+    {
+        free_2D_array(H_out, rows_H);
+        return 1;
+    }
+
+    failed = symnmf_partitioned(t, H_out, rows_H, cols_H, W, N_W);
+
+    /* Only rank 0 returns from finalize */
+    if (t->finalize(t) != 0)
+        failed = 1;
+    if (failed)
+    {
+        free_2D_array(H_out, rows_H);
+        return 1;
+    }
+    return 0;
+}
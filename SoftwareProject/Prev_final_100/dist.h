@@ -0,0 +1,43 @@
+#ifndef DIST_H
+#define DIST_H
+
+/*
+ * Communication endpoint of one worker of the row-partitioned SymNMF engine.
+ * A backend creates one endpoint per worker process; worker 'rank' owns the rows
+ * [rank * rows / size, (rank + 1) * rows / size) of W and H.
+ */
+typedef struct transport
+{
+    int rank, size;
+
+    /* Sums 'len' doubles of 'buf' over all workers, every worker receives the sum in 'buf'. Returns 0 on success. */
+    int (*allreduce_sum)(struct transport *self, double *buf, const int len);
+
+    /* Publishes the local rows ['lo', 'hi') of 'H' and receives the rows of all other workers. Returns 0 on success. */
+    int (*allgather_rows)(struct transport *self, double **H, const int lo, const int hi, const int cols);
+
+    /* Releases the endpoint. Workers other than rank 0 terminate here, rank 0 waits for them. */
+    int (*finalize)(struct transport *self);
+
+    void *impl;
+} transport;
+
+/*
+ * A transport backend. 'launch' starts 'size' workers that exchange at most 'rows' x 'cols' H rows
+ * and 'reduce_len' doubles per reduction, and returns in every worker with its own endpoint.
+ */
+typedef struct transport_backend
+{
+    const char *name;
+    int (*launch)(transport **t, const int size, const int rows, const int cols, const int reduce_len);
+} transport_backend;
+
+/* Forked workers on one machine, exchanging through an anonymous shared mapping */
+extern const transport_backend shm_backend;
+
+int symnmf_partitioned(transport *t, double ***H, const int rows_H, const int cols_H, double ***W, const int N_W);
+
+int C_symnmf_distributed(double ***H_out, double ***H_in, const int rows_H, const int cols_H,
+                         double ***W, const int N_W, const int workers, const transport_backend *backend);
+
+#endif
@@ -0,0 +1,575 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "symnmf.h"
+#include "ingest.h"
+#include "isa.h"
+#include "tune.h"
+
+#define DELIMITER ','
+
+/*
+ * Pipelined ingest: parsing overlaps the quadratic similarity work instead of preceding it.
+ *
+ *   reader --text blocks--> parsers --row blocks--> tile workers
+ *
+ * The reader cuts the file into blocks of INGEST_BLOCK_ROWS lines, parser threads turn them into rows of X,
+ * and every tile worker that receives a parsed block b computes the similarity tiles between b and each block
+ * published before it, then publishes b. Each pair of blocks thus meets exactly once, as soon as the later of
+ * the two is parsed. The tiles are not kept: they only feed the degrees, which is all the streaming goals need
+ * before the whole of X is known. The queues are bounded, so a slow stage stalls the ones feeding it rather
+ * than letting parsed text pile up.
+ *
+ * Every tile worker sums into its own degree vector and the vectors are added at the end, so a degree can
+ * differ from the sequential C_ddg sum by rounding.
+ */
+
+typedef struct ingest_block
+{
+    int first_row, rows;
+    char *text;
+    double **X;
+} ingest_block;
+
+typedef struct block_queue
+{
+    ingest_block *items[INGEST_QUEUE_BLOCKS];
+    int head, count, closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+} block_queue;
+
+typedef struct tile_worker
+{
+    struct ingest_state *state;
+    double *D;
+    int capacity;
+    pthread_t thread;
+} tile_worker;
+
+typedef struct ingest_state
+{
+    FILE *file;
+    const isa_kernels *isa;
+    int cols, need_D, failed, parsers_left;
+    block_queue text, parsed;
+
+    /* Blocks whose tiles against all earlier blocks are done or in progress, in publication order */
+    pthread_mutex_t lock;
+    ingest_block **published;
+    int n_published, published_capacity;
+} ingest_state;
+
+static void queue_init(block_queue *q)
+{
+    q->head = 0;
+    q->count = 0;
+    q->closed = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+static void queue_destroy(block_queue *q)
+{
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
+
+/*
+ * Appends 'b' to '*q', waiting while the queue is full.
+ * Returns 0 on success, 1 if the queue was closed (the pipeline failed), in which case 'b' is not queued.
+ */
+static int queue_push(block_queue *q, ingest_block *b)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == INGEST_QUEUE_BLOCKS && !q->closed)
+        pthread_cond_wait(&q->not_full, &q->lock);
+    if (q->closed)
+    {
+        pthread_mutex_unlock(&q->lock);
+        return 1;
+    }
+    q->items[(q->head + q->count++) % INGEST_QUEUE_BLOCKS] = b;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+/*
+ * Returns the oldest block of '*q', waiting while the queue is empty, or NULL once it is closed and drained.
+ */
+static ingest_block *queue_pop(block_queue *q)
+{
+    ingest_block *b = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->closed)
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    if (q->count > 0)
+    {
+        b = q->items[q->head];
+        q->head = (q->head + 1) % INGEST_QUEUE_BLOCKS;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return b;
+}
+
+/*
+ * Stops accepting blocks, the consumers drain what is queued.
+ */
+static void queue_close(block_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static void free_block(ingest_block *b)
+{
+    if (b == NULL)
+        return;
+    free(b->text);
+    if (b->X != NULL)
+        free_2D_array(&b->X, b->rows);
+    free(b);
+}
+
+/*
+ * Marks the pipeline as failed and closes both queues, every stage then winds down.
+ */
+static void fail(ingest_state *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->failed = 1;
+    pthread_mutex_unlock(&s->lock);
+    queue_close(&s->text);
+    queue_close(&s->parsed);
+}
+
+/*
+ * Returns the number of rows in 'len' bytes of text: its lines, the last one may lack its '\n'.
+ * Blank lines are no rows, read_file skips them too (strtod in parse_block steps over them).
+ */
+static int count_rows(const char *text, const size_t len)
+{
+    size_t i;
+    int rows = 0, blank = 1;
+    for (i = 0; i < len; i++)
+    {
+        if (text[i] == '\n')
+        {
+            rows += !blank;
+            blank = 1;
+        }
+        else if (!isspace((unsigned char)text[i]))
+            blank = 0;
+    }
+    return rows + !blank;
+}
+
+/*
+ * Queues the 'len' bytes at 'text' as the block starting at row 'first_row', unless they hold no row.
+ * Returns 0 on success.
+ */
+static int emit_block(ingest_state *s, const char *text, const size_t len, const int first_row)
+{
+    ingest_block *b;
+
+    if (count_rows(text, len) == 0)
+        return 0;
+    b = (ingest_block *)calloc(1, sizeof(ingest_block));
+    if (b == NULL)
+        return 1;
+    b->text = (char *)malloc(len + 1);
+    if (b->text == NULL)
+    {
+        free(b);
+        return 1;
+    }
+    memcpy(b->text, text, len);
+    b->text[len] = '\0';
+    b->first_row = first_row;
+    b->rows = count_rows(text, len);
+    if (queue_push(&s->text, b) != 0)
+    {
+        free_block(b);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Reads the file in INGEST_CHUNK_BYTES chunks and cuts it into blocks of INGEST_BLOCK_ROWS lines.
+ * Returns the number of rows, -1 on failure.
+ */
+static long read_blocks(ingest_state *s)
+{
+    char *buf, *grown;
+    size_t len = 0, cap = 2 * INGEST_CHUNK_BYTES, start = 0, pos = 0, got;
+    long rows = 0;
+    int lines = 0;
+
+    buf = (char *)malloc(cap);
+    if (buf == NULL)
+        return -1;
+    for (;;)
+    {
+        if (cap - len < INGEST_CHUNK_BYTES)
+        {
+            /* Drop the bytes already handed out, grow only if one block outgrows the buffer */
+            memmove(buf, buf + start, len - start);
+            len -= start;
+            pos -= start;
+            start = 0;
+            if (cap - len < INGEST_CHUNK_BYTES)
+            {
+                grown = (char *)realloc(buf, 2 * cap);
+                if (grown == NULL)
+                    break;
+                buf = grown;
+                cap *= 2;
+            }
+        }
+        got = fread(buf + len, 1, INGEST_CHUNK_BYTES, s->file);
+        len += got;
+
+        for (; pos < len; pos++)
+        {
+            if (buf[pos] == '\n' && ++lines == INGEST_BLOCK_ROWS)
+            {
+                if (emit_block(s, buf + start, pos + 1 - start, (int)rows) != 0)
+                {
+                    free(buf);
+                    return -1;
+                }
+                rows += count_rows(buf + start, pos + 1 - start);
+                lines = 0;
+                start = pos + 1;
+            }
+        }
+
+        if (got == 0)
+        {
+            if (ferror(s->file) || (len > start && emit_block(s, buf + start, len - start, (int)rows) != 0))
+                break;
+            rows += count_rows(buf + start, len - start);
+            free(buf);
+            return rows;
+        }
+    }
+    free(buf);
+    return -1;
+}
+
+/*
+ * Parses the text of 'b' into 'b->X', the format of read_file with exactly 'cols' numbers per line.
+ * Returns 0 on success.
+ */
+static int parse_block(ingest_block *b, const int cols)
+{
+    char *p = b->text, *end;
+    int row, col;
+
+    if (allocate_2D_array(&b->X, b->rows, cols) != 0)
+    {
+        b->X = NULL;
+        return 1;
+    }
+    for (row = 0; row < b->rows; row++)
+    {
+        for (col = 0; col < cols; col++)
+        {
+            b->X[row][col] = strtod(p, &end);
+            if (end == p)
+                return 1;
+            p = end;
+            if (col < cols - 1 ? *p != DELIMITER : *p != '\n' && *p != '\0')
+                return 1;
+            if (*p != '\0')
+                p++;
+        }
+    }
+    free(b->text);
+    b->text = NULL;
+    return 0;
+}
+
+static void *parser_main(void *arg)
+{
+    ingest_state *s = (ingest_state *)arg;
+    ingest_block *b;
+    int last;
+
+    while ((b = queue_pop(&s->text)) != NULL)
+    {
+        if (parse_block(b, s->cols) != 0 || queue_push(&s->parsed, b) != 0)
+        {
+            free_block(b);
+            fail(s);
+        }
+    }
+
+    /* The last parser out ends the stream of parsed blocks */
+    pthread_mutex_lock(&s->lock);
+    last = --s->parsers_left == 0;
+    pthread_mutex_unlock(&s->lock);
+    if (last)
+        queue_close(&s->parsed);
+    return NULL;
+}
+
+/*
+ * Adds the tile of the blocks 'a' and 'b' (with 'a' == 'b' for a diagonal tile) to the degrees 'D'.
+ */
+static void add_tile(double *D, ingest_block *a, ingest_block *b, const int cols, const isa_kernels *isa)
+{
+    int i, j;
+    double a_ij;
+    for (i = 0; i < a->rows; i++)
+    {
+        for (j = a == b ? i + 1 : 0; j < b->rows; j++)
+        {
+            a_ij = exp(-SYM_KERNEL_SCALE * isa->dist2(a->X[i], b->X[j], cols));
+            D[a->first_row + i] += a_ij;
+            D[b->first_row + j] += a_ij;
+        }
+    }
+}
+
+/*
+ * Grows the degree vector of 'w' to at least 'rows' entries, the new ones 0.
+ * Returns 0 on success.
+ */
+static int reserve_degrees(tile_worker *w, const int rows)
+{
+    double *grown;
+    int cap = w->capacity > 0 ? w->capacity : INGEST_BLOCK_ROWS;
+
+    if (rows <= w->capacity)
+        return 0;
+    while (cap < rows)
+        cap *= 2;
+    grown = (double *)realloc(w->D, cap * sizeof(double));
+    if (grown == NULL)
+        return 1;
+    memset(grown + w->capacity, 0, (cap - w->capacity) * sizeof(double));
+    w->D = grown;
+    w->capacity = cap;
+    return 0;
+}
+
+static void *tile_main(void *arg)
+{
+    tile_worker *w = (tile_worker *)arg;
+    ingest_state *s = w->state;
+    const isa_kernels *isa = s->isa;
+    ingest_block *b, **grown, **earlier = NULL;
+    int n, i, ok, end;
+
+    while ((b = queue_pop(&s->parsed)) != NULL)
+    {
+        /* Snapshot the blocks published so far and publish 'b', the tiles between them are this worker's */
+        pthread_mutex_lock(&s->lock);
+        ok = !s->failed;
+        if (ok && s->n_published == s->published_capacity)
+        {
+            n = s->published_capacity > 0 ? 2 * s->published_capacity : 64;
+            grown = (ingest_block **)realloc(s->published, n * sizeof(ingest_block *));
+            ok = grown != NULL;
+            if (ok)
+            {
+                s->published = grown;
+                s->published_capacity = n;
+            }
+        }
+        n = s->n_published;
+        if (ok)
+        {
+            grown = (ingest_block **)realloc(earlier, (n + 1) * sizeof(ingest_block *));
+            ok = grown != NULL;
+            if (ok)
+            {
+                earlier = grown;
+                memcpy(earlier, s->published, n * sizeof(ingest_block *));
+                s->published[s->n_published++] = b;
+            }
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        if (!ok)
+        {
+            free_block(b);
+            fail(s);
+            continue;
+        }
+        if (!s->need_D)
+            continue;
+        /* Blocks are published in parse order, which need not be file order */
+        end = b->first_row + b->rows;
+        for (i = 0; i < n; i++)
+            end = earlier[i]->first_row + earlier[i]->rows > end ? earlier[i]->first_row + earlier[i]->rows : end;
+        if (reserve_degrees(w, end) != 0)
+        {
+            fail(s);
+            continue;
+        }
+        add_tile(w->D, b, b, s->cols, isa);
+        for (i = 0; i < n; i++)
+            add_tile(w->D, b, earlier[i], s->cols, isa);
+    }
+    free(earlier);
+    return NULL;
+}
+
+/*
+ * Returns the number of columns of the first line of 'file', 0 if there is none. The file is rewound.
+ */
+static int first_line_cols(FILE *file)
+{
+    int c, cols = 0, seen = 0;
+    while ((c = fgetc(file)) != EOF && c != '\n')
+    {
+        seen = 1;
+        cols += c == DELIMITER;
+    }
+    rewind(file);
+    return seen ? cols + 1 : 0;
+}
+
+/*
+ * Returns the thread count of INGEST_ENV, else of the tuning profile, 0 if the pipelined ingest is not requested.
+ */
+int ingest_threads(void)
+{
+    char *val = getenv(INGEST_ENV);
+    int threads = val != NULL ? atoi(val) : tuning_current()->ingest_threads;
+    return threads > 0 ? threads : 0;
+}
+
+/*
+ * Read the data points from 'file_name' into '*X' with a pipeline of 'threads' threads besides the reader,
+ * and, if 'D' is not NULL, calculate their degrees into '*D' while the file is still being parsed.
+ * pre: '*X' and '*D' are NOT dynamically allocated.
+ * Returns 0 on success.
+ *
+ * 'file_name' - Address of 1D char array that represents the name of a file, in the format of read_file.
+ * 'rows', 'cols' - Address for an integer variable.
+ */
+int ingest_file(double ***X, double **D, char **file_name, int *rows, int *cols, const int threads)
+{
+    ingest_state s;
+    tile_worker *workers;
+    pthread_t *parsers;
+    int n_parsers, n_workers, started_parsers, started_workers, i, j, r, failed;
+    long total = -1;
+
+    memset(&s, 0, sizeof(s));
+    s.file = fopen(*file_name, "r");
+    if (s.file == NULL)
+        return 1;
+    s.cols = first_line_cols(s.file);
+    if (s.cols == 0)
+    {
+        fclose(s.file);
+        return 1;
+    }
+    s.need_D = D != NULL;
+    /* Resolved before the workers start, isa_select caches its choice without a lock */
+    s.isa = isa_select();
+
+    /* Parsing is cheap next to the tiles, a quarter of the threads keeps the tile workers fed */
+    n_parsers = threads / 4 > 1 ? threads / 4 : 1;
+    n_workers = threads - n_parsers > 1 ? threads - n_parsers : 1;
+    parsers = (pthread_t *)malloc(n_parsers * sizeof(pthread_t));
+    workers = (tile_worker *)calloc(n_workers, sizeof(tile_worker));
+    if (parsers == NULL || workers == NULL)
+    {
+        free(parsers);
+        free(workers);
+        fclose(s.file);
+        return 1;
+    }
+
+    queue_init(&s.text);
+    queue_init(&s.parsed);
+    pthread_mutex_init(&s.lock, NULL);
+    s.parsers_left = n_parsers;
+    for (started_parsers = 0; started_parsers < n_parsers; started_parsers++)
+    {
+        if (pthread_create(&parsers[started_parsers], NULL, parser_main, &s) != 0)
+            break;
+    }
+    for (started_workers = 0; started_parsers == n_parsers && started_workers < n_workers; started_workers++)
+    {
+        workers[started_workers].state = &s;
+        if (pthread_create(&workers[started_workers].thread, NULL, tile_main, &workers[started_workers]) != 0)
+            break;
+    }
+
+    /* A thread that did not start fails the pipeline, the started ones see the closed queues and return */
+    if (started_parsers == n_parsers && started_workers == n_workers)
+        total = read_blocks(&s);
+    if (total < 0)
+        fail(&s);
+    queue_close(&s.text);
+    for (i = 0; i < started_parsers; i++)
+        pthread_join(parsers[i], NULL);
+    for (i = 0; i < started_workers; i++)
+        pthread_join(workers[i].thread, NULL);
+    fclose(s.file);
+
+    failed = s.failed || total <= 0;
+    *rows = (int)total;
+    *cols = s.cols;
+
+    /* X takes over the rows of the blocks, D sums the degrees of the workers */
+    if (!failed)
+    {
+        *X = (double **)malloc(total * sizeof(double *));
+        if (s.need_D)
+            *D = (double *)calloc(total, sizeof(double));
+        failed = *X == NULL || (s.need_D && *D == NULL);
+        if (failed)
+        {
+            free(*X);
+            if (s.need_D)
+                free(*D);
+        }
+    }
+    for (i = 0; i < s.n_published; i++)
+    {
+        if (!failed)
+        {
+            for (r = 0; r < s.published[i]->rows; r++)
+                (*X)[s.published[i]->first_row + r] = s.published[i]->X[r];
+            free(s.published[i]->X);
+            s.published[i]->X = NULL;
+        }
+        free_block(s.published[i]);
+    }
+    for (i = 0; i < n_workers; i++)
+    {
+        for (j = 0; !failed && j < workers[i].capacity && j < total; j++)
+            (*D)[j] += workers[i].D[j];
+        free(workers[i].D);
+    }
+
+    free(s.published);
+    free(parsers);
+    free(workers);
+    queue_destroy(&s.text);
+    queue_destroy(&s.parsed);
+    pthread_mutex_destroy(&s.lock);
+    return failed;
+}
@@ -0,0 +1,23 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+/*
+ * Threads of the pipelined ingest of the CLI, unset or 0 for the sequential read_file.
+ * Used with and without SYMNMF_CACHE_DIR; only the streamed goals take its degrees.
+ */
+#define INGEST_ENV "SYMNMF_INGEST_THREADS"
+
+/* Lines per block handed between the stages */
+#define INGEST_BLOCK_ROWS 1024
+
+/* Bytes read from the file at once by the reader */
+#define INGEST_CHUNK_BYTES (1024 * 1024)
+
+/* Capacity of each queue between two stages, in blocks. A full queue stalls the stage feeding it. */
+#define INGEST_QUEUE_BLOCKS 8
+
+int ingest_threads(void);
+
+int ingest_file(double ***X, double **D, char **file_name, int *rows, int *cols, const int threads);
+
+#endif
@@ -0,0 +1,226 @@
+#include <math.h>
+#include <stdlib.h>
+#include "symnmf.h"
+#include "init.h"
+#include "kernels.h"
+
+/*
+ * NNDSVD-style initial H.
+ * W is symmetric, so its SVD is an eigen decomposition W ~= U * diag(lambda) * U^T. The leading eigenpairs come
+ * from a randomized subspace iteration that only multiplies W by thin N x p blocks with the mul_rows kernel of
+ * the updates, followed by a Rayleigh-Ritz step on the p x p projection. Column j of H is sqrt(lambda_j) times
+ * the larger of the positive and negative parts of u_j, and the zeros are filled with the mean of H
+ * (as NNDSVDa does), since the multiplicative updates can never move an entry away from 0.
+ */
+
+/*
+ * Orthonormalize the 'cols' columns of '*Q' in place by modified Gram-Schmidt.
+ *
+ * 'Q' - Address of 2D array with dimensions 'rows' x 'cols'.
+ */
+static void orthonormalize(double ***Q, const int rows, const int cols)
+{
+    int i, c, p;
+    double dot, norm;
+    for (c = 0; c < cols; c++)
+    {
+        for (p = 0; p < c; p++)
+        {
+            dot = 0;
+            for (i = 0; i < rows; i++)
+                dot += (*Q)[i][p] * (*Q)[i][c];
+            for (i = 0; i < rows; i++)
+                (*Q)[i][c] -= dot * (*Q)[i][p];
+        }
+        norm = 0;
+        for (i = 0; i < rows; i++)
+            norm += (*Q)[i][c] * (*Q)[i][c];
+        /* A column in the span of the previous ones stays 0 and drops out of the Ritz pairs */
+        norm = norm > 0 ? 1 / sqrt(norm) : 0;
+        for (i = 0; i < rows; i++)
+            (*Q)[i][c] *= norm;
+    }
+}
+
+/*
+ * Calculate the leading 'p' eigenvectors of '*W' with their eigenvalues, in decreasing order of eigenvalue,
+ * and place them in the columns of '*Q' and in '*lambda'.
+ * pre: '*Q' is an 'N' x 'p' array of random starting vectors, '*lambda' is NOT dynamically allocated.
+ * Returns 0 on success.
+ */
+static int leading_eigen(double ***Q, double **lambda, double ***W, const int N, const int p)
+{
+    const symnmf_kernels *kernels = select_kernels(p);
+    double **Y, **B, **V, **T, *mu;
+    int iter, i, a, b, c, *order, t, best;
+
+    if (allocate_2D_array(&Y, N, p) != 0)
+        return 1;
+    for (iter = 0; iter < INIT_POWER_ITERS; iter++)
+    {
+        orthonormalize(Q, N, p);
+        kernels->mul_rows(Y, *W, *Q, N, 0, N, p);
+        copy_matrix(Q, &Y, N, p);
+    }
+    orthonormalize(Q, N, p);
+    kernels->mul_rows(Y, *W, *Q, N, 0, N, p);
+
+    /* B = Q^T * W * Q, symmetrized against rounding */
+    if (allocate_2D_array(&B, p, p) != 0)
+    {
+        free_2D_array(&Y, N);
+        return 1;
+    }
+    for (i = 0; i < N; i++)
+    {
+        for (a = 0; a < p; a++)
+        {
+            for (b = 0; b < p; b++)
+                B[a][b] += (*Q)[i][a] * Y[i][b];
+        }
+    }
+    for (a = 0; a < p; a++)
+    {
+        for (b = a + 1; b < p; b++)
+        {
+            B[a][b] = (B[a][b] + B[b][a]) / 2;
+            B[b][a] = B[a][b];
+        }
+    }
+    free_2D_array(&Y, N);
+
+    if (jacobi_eigen(&V, &mu, &B, p) != 0)
+    {
+        free_2D_array(&B, p);
+        return 1;
+    }
+    free_2D_array(&B, p);
+
+    order = (int *)malloc(p * sizeof(int));
+    *lambda = (double *)malloc(p * sizeof(double));
+    if (order == NULL || *lambda == NULL || allocate_2D_array(&T, N, p) != 0)
+    {
+        free(order);
+        free(*lambda);
+        free(mu);
+        free_2D_array(&V, p);
+        return 1;
+    }
+    for (a = 0; a < p; a++)
+        order[a] = a;
+    for (a = 0; a < p; a++)
+    {
+        best = a;
+        for (b = a + 1; b < p; b++)
+        {
+            if (mu[order[b]] > mu[order[best]])
+                best = b;
+        }
+        t = order[a];
+        order[a] = order[best];
+        order[best] = t;
+        (*lambda)[a] = mu[order[a]];
+    }
+
+    /* Ritz vectors Q * V, reordered */
+    for (i = 0; i < N; i++)
+    {
+        for (a = 0; a < p; a++)
+        {
+            for (c = 0; c < p; c++)
+                T[i][a] += (*Q)[i][c] * V[c][order[a]];
+        }
+    }
+    copy_matrix(Q, &T, N, p);
+
+    free_2D_array(&T, N);
+    free_2D_array(&V, p);
+    free(order);
+    free(mu);
+    return 0;
+}
+
+/*
+ * Calculate the NNDSVD-style initial H for the normalized similarity matrix '*W' and place it in '*H'.
+ * Costs (INIT_POWER_ITERS + 1) multiplications of W by an 'N' x (k + INIT_OVERSAMPLE) block.
+ * pre: '*H' is NOT dynamically allocated.
+ * Returns 0 on success.
+ *
+ * 'W' - Address of a 2D array with dimensions 'N' x 'N'.
+ * 'seed' - Seed of the starting block, the result is deterministic for a given seed.
+ */
+int C_init_nndsvd(double ***H, double ***W, const int N, const int k, const unsigned long seed)
+{
+    unsigned long state = seed;
+    double **Q, *lambda, pos, neg, scale, mean;
+    int p, i, j;
+
+    if (k < 1 || k > N)
+        return 1;
+    for (p = k + INIT_OVERSAMPLE; p < 2 * (k + INIT_OVERSAMPLE) && select_kernels(p)->k != p; p++)
+        ;
+    if (select_kernels(p)->k != p)
+        p = k + INIT_OVERSAMPLE;
+    if (p > N)
+        p = N;
+
+    if (allocate_2D_array(&Q, N, p) != 0)
+        return 1;
+    for (i = 0; i < N; i++)
+    {
+        for (j = 0; j < p; j++)
+            Q[i][j] = 2 * (lcg_next(&state) / 9007199254740992.0) - 1;
+    }
+    if (leading_eigen(&Q, &lambda, W, N, p) != 0)
+    {
+        free_2D_array(&Q, N);
+        return 1;
+    }
+    if (allocate_2D_array(H, N, k) != 0)
+    {
+        free_2D_array(&Q, N);
+        free(lambda);
+        return 1;
+    }
+
+    mean = 0;
+    for (j = 0; j < k; j++)
+    {
+        /* A non-positive eigenvalue has no nonnegative factor, its column is left to the fill */
+        if (lambda[j] <= 0)
+            continue;
+        pos = 0;
+        neg = 0;
+        for (i = 0; i < N; i++)
+        {
+            if (Q[i][j] > 0)
+                pos += Q[i][j] * Q[i][j];
+            else
+                neg += Q[i][j] * Q[i][j];
+        }
+        scale = sqrt(lambda[j]) * (pos >= neg ? 1 : -1);
+        for (i = 0; i < N; i++)
+        {
+            (*H)[i][j] = scale * Q[i][j] > 0 ? scale * Q[i][j] : 0;
+            mean += (*H)[i][j];
+        }
+    }
+    free_2D_array(&Q, N);
+    free(lambda);
+
+    mean /= (double)N * k;
+    if (mean == 0)
+    {
+        free_2D_array(H, N);
+        return 1;
+    }
+    for (i = 0; i < N; i++)
+    {
+        for (j = 0; j < k; j++)
+        {
+            if ((*H)[i][j] == 0)
+                (*H)[i][j] = mean;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef INIT_H
+#define INIT_H
+
+/*
+ * The subspace iteration tracks at least INIT_OVERSAMPLE directions beyond the k it keeps, rounded up to the
+ * next block width with specialized kernels when that at most doubles it
+ */
+#define INIT_OVERSAMPLE 4
+
+/* Multiplications by W of the subspace iteration before the Rayleigh-Ritz step */
+#define INIT_POWER_ITERS 4
+
+int C_init_nndsvd(double ***H, double ***W, const int N, const int k, const unsigned long seed);
+
+#endif
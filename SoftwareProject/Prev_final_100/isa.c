@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "isa.h"
+#include "tune.h"
+
+#ifdef ISA_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Generic kernels, the reference results of every other variant.
+ */
+
+static double dist2_generic(const double *x, const double *y, const int d)
+{
+    double sum = 0, diff;
+    int l;
+    for (l = 0; l < d; l++)
+    {
+        diff = x[l] - y[l];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+static double row_sum_generic(const double *row, const int n)
+{
+    double sum = 0;
+    int j;
+    for (j = 0; j < n; j++)
+        sum += row[j];
+    return sum;
+}
+
+static void scale_row_generic(double *out, const double *row, const double *p, const double p_i, const int n)
+{
+    int j;
+    for (j = 0; j < n; j++)
+        out[j] = row[j] * p[j] * p_i;
+}
+
+static const isa_kernels generic_isa = {ISA_GENERIC, "generic", dist2_generic, row_sum_generic, scale_row_generic};
+
+#ifdef ISA_X86
+
+/*
+ * AVX2 + FMA kernels, 4 doubles per vector.
+ */
+
+ISA_TARGET_AVX2 static double dist2_avx2(const double *x, const double *y, const int d)
+{
+    __m256d acc = _mm256_setzero_pd(), diff;
+    double lanes[4], sum, t;
+    int l;
+    for (l = 0; l + 4 <= d; l += 4)
+    {
+        diff = _mm256_sub_pd(_mm256_loadu_pd(x + l), _mm256_loadu_pd(y + l));
+        acc = _mm256_fmadd_pd(diff, diff, acc);
+    }
+    _mm256_storeu_pd(lanes, acc);
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; l < d; l++)
+    {
+        t = x[l] - y[l];
+        sum += t * t;
+    }
+    return sum;
+}
+
+ISA_TARGET_AVX2 static double row_sum_avx2(const double *row, const int n)
+{
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    double lanes[4], sum;
+    int j;
+    for (j = 0; j + 8 <= n; j += 8)
+    {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(row + j));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(row + j + 4));
+    }
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; j < n; j++)
+        sum += row[j];
+    return sum;
+}
+
+ISA_TARGET_AVX2 static void scale_row_avx2(double *out, const double *row, const double *p, const double p_i,
+                                           const int n)
+{
+    __m256d v_i = _mm256_set1_pd(p_i);
+    int j;
+    for (j = 0; j + 4 <= n; j += 4)
+        _mm256_storeu_pd(out + j, _mm256_mul_pd(_mm256_mul_pd(_mm256_loadu_pd(row + j), _mm256_loadu_pd(p + j)), v_i));
+    for (; j < n; j++)
+        out[j] = row[j] * p[j] * p_i;
+}
+
+/*
+ * AVX-512 kernels, 8 doubles per vector.
+ */
+
+ISA_TARGET_AVX512 static double dist2_avx512(const double *x, const double *y, const int d)
+{
+    __m512d acc = _mm512_setzero_pd(), diff;
+    double lanes[8], sum, t;
+    int l;
+    for (l = 0; l + 8 <= d; l += 8)
+    {
+        diff = _mm512_sub_pd(_mm512_loadu_pd(x + l), _mm512_loadu_pd(y + l));
+        acc = _mm512_fmadd_pd(diff, diff, acc);
+    }
+    _mm512_storeu_pd(lanes, acc);
+    sum = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    for (; l < d; l++)
+    {
+        t = x[l] - y[l];
+        sum += t * t;
+    }
+    return sum;
+}
+
+ISA_TARGET_AVX512 static double row_sum_avx512(const double *row, const int n)
+{
+    __m512d acc0 = _mm512_setzero_pd(), acc1 = _mm512_setzero_pd();
+    double lanes[8], sum;
+    int j;
+    for (j = 0; j + 16 <= n; j += 16)
+    {
+        acc0 = _mm512_add_pd(acc0, _mm512_loadu_pd(row + j));
+        acc1 = _mm512_add_pd(acc1, _mm512_loadu_pd(row + j + 8));
+    }
+    _mm512_storeu_pd(lanes, _mm512_add_pd(acc0, acc1));
+    sum = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    for (; j < n; j++)
+        sum += row[j];
+    return sum;
+}
+
+ISA_TARGET_AVX512 static void scale_row_avx512(double *out, const double *row, const double *p, const double p_i,
+                                               const int n)
+{
+    __m512d v_i = _mm512_set1_pd(p_i);
+    int j;
+    for (j = 0; j + 8 <= n; j += 8)
+        _mm512_storeu_pd(out + j, _mm512_mul_pd(_mm512_mul_pd(_mm512_loadu_pd(row + j), _mm512_loadu_pd(p + j)), v_i));
+    for (; j < n; j++)
+        out[j] = row[j] * p[j] * p_i;
+}
+
+static const isa_kernels avx2_isa = {ISA_AVX2, "avx2", dist2_avx2, row_sum_avx2, scale_row_avx2};
+static const isa_kernels avx512_isa = {ISA_AVX512, "avx512", dist2_avx512, row_sum_avx512, scale_row_avx512};
+
+#endif
+
+/* Every instruction set by level, up to the highest one this build knows */
+#ifdef ISA_X86
+static const isa_kernels *const levels[] = {&generic_isa, &avx2_isa, &avx512_isa};
+#else
+static const isa_kernels *const levels[] = {&generic_isa};
+#endif
+
+static const isa_kernels *selected = NULL;
+
+/* The diagnostic for a bad SYMNMF_ISA is printed once, not on every isa_reset */
+static int reported = 0;
+
+/*
+ * Returns the highest level the CPU supports.
+ */
+static int supported_level(void)
+{
+    int top = ISA_GENERIC;
+#ifdef ISA_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        top = ISA_AVX2;
+    if (top == ISA_AVX2 && __builtin_cpu_supports("avx512f"))
+        top = ISA_AVX512;
+#endif
+    return top;
+}
+
+/*
+ * Returns the level named 'name' ("generic", "avx2" or "avx512"), or -1 if the name is unknown.
+ */
+static int level_by_name(const char *name)
+{
+    static const char *const names[] = {"generic", "avx2", "avx512"};
+    int i;
+    for (i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Returns the best kernels the CPU supports, or the ones forced by SYMNMF_ISA, or else by the tuning profile.
+ * A SYMNMF_ISA value that is unknown, or names an instruction set the CPU or the build lacks, is reported on
+ * stderr together with the level used instead.
+ * The choice is made by CPUID on the first call and kept until isa_reset.
+ */
+const isa_kernels *isa_select(void)
+{
+    char *forced;
+    int top, level;
+
+    if (selected != NULL)
+        return selected;
+
+    top = supported_level();
+    level = top;
+
+    forced = getenv(ISA_ENV);
+    if (forced != NULL)
+    {
+        level = level_by_name(forced);
+        if ((level < 0 || level > top) && !reported)
+        {
+            reported = 1;
+            fprintf(stderr, "%s=%s is %s, using %s\n", ISA_ENV, forced,
+                    level < 0 ? "unknown" : "not supported here", levels[top]->name);
+        }
+        if (level < 0 || level > top)
+            level = top;
+    }
+    else if (tuning_current()->isa_level >= ISA_GENERIC && tuning_current()->isa_level < top)
+        level = tuning_current()->isa_level;
+
+    selected = levels[level];
+    return selected;
+}
+
+/*
+ * Drops the choice of isa_select, the next call chooses again.
+ * pre: no kernel runs concurrently.
+ */
+void isa_reset(void)
+{
+    selected = NULL;
+}
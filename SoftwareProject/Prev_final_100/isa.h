@@ -0,0 +1,43 @@
+#ifndef ISA_H
+#define ISA_H
+
+/* Forces an instruction set: "generic", "avx2" or "avx512". Reported on stderr if unknown or the CPU lacks it. */
+#define ISA_ENV "SYMNMF_ISA"
+
+/* GCC and Clang on x86 build the AVX variants next to the generic code, one binary serves every CPU */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ISA_X86 1
+#define ISA_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define ISA_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+#endif
+
+typedef enum isa_level
+{
+    ISA_GENERIC = 0,
+    ISA_AVX2 = 1,
+    ISA_AVX512 = 2
+} isa_level;
+
+/*
+ * Hot vector kernels of the similarity, degree and normalization steps in one instruction set.
+ */
+typedef struct isa_kernels
+{
+    isa_level level;
+    const char *name;
+
+    /* Returns ||x - y||^2 for vectors of length 'd' */
+    double (*dist2)(const double *x, const double *y, const int d);
+
+    /* Returns the sum of the 'n' entries of 'row' */
+    double (*row_sum)(const double *row, const int n);
+
+    /* out[j] = row[j] * p[j] * p_i for j in [0, 'n') */
+    void (*scale_row)(double *out, const double *row, const double *p, const double p_i, const int n);
+} isa_kernels;
+
+const isa_kernels *isa_select(void);
+
+void isa_reset(void);
+
+#endif
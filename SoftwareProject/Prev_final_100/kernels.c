@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <string.h>
+#include "kernels.h"
+#include "isa.h"
+#include "tune.h"
+
+/*
+ * Generic kernels, k is a runtime bound.
+ */
+
+static void gram_generic(double *HtH, double **H, const int rows, const int k)
+{
+    int i, l, c;
+    memset(HtH, 0, (size_t)k * k * sizeof(double));
+    for (i = 0; i < rows; i++)
+    {
+        for (l = 0; l < k; l++)
+        {
+            for (c = 0; c < k; c++)
+                HtH[l * k + c] += H[i][l] * H[i][c];
+        }
+    }
+}
+
+static void mul_rows_generic(double **out, double **W, double **H, const int N, const int lo, const int hi,
+                             const int k)
+{
+    int i, j, c;
+    double w, *acc;
+    for (i = lo; i < hi; i++)
+    {
+        acc = out[i - lo];
+        memset(acc, 0, k * sizeof(double));
+        for (j = 0; j < N; j++)
+        {
+            w = W[i][j];
+            for (c = 0; c < k; c++)
+                acc[c] += w * H[j][c];
+        }
+    }
+}
+
+static int update_rows_generic(double **out, double **W, double **H, const int N, const double *HtH,
+                               const int lo, const int hi, const int k, const double beta, double *stats)
+{
+    int i, j, l, c;
+    double w, den, diff, *num;
+
+    num = (double *)malloc(k * sizeof(double));
+    if (num == NULL)
+        return 1;
+    for (i = lo; i < hi; i++)
+    {
+        memset(num, 0, k * sizeof(double));
+        for (j = 0; j < N; j++)
+        {
+            w = W[i][j];
+            for (c = 0; c < k; c++)
+                num[c] += w * H[j][c];
+        }
+        for (c = 0; c < k; c++)
+        {
+            den = 0;
+            for (l = 0; l < k; l++)
+                den += H[i][l] * HtH[l * k + c];
+            if (den == 0)
+            {
+                /* Division by zero */
+                free(num);
+                return 1;
+            }
+            out[i - lo][c] = H[i][c] * (1 - beta + beta * (num[c] / den));
+            if (stats != NULL)
+            {
+                diff = out[i - lo][c] - H[i][c];
+                stats[0] += H[i][c] * num[c];
+                stats[1] += diff * diff;
+            }
+        }
+    }
+    free(num);
+    return 0;
+}
+
+/*
+ * Specialized kernels: the loops over k have the compile time bound K, so the compiler fully unrolls them
+ * and keeps the accumulators of a whole H row in (vector) registers while streaming a W row.
+ * Every specialization is built once per instruction set 'ISA', with the function attribute KERNEL_TARGET_##ISA.
+ */
+#define DEFINE_KERNELS(K, ISA)                                                                                       \
+    KERNEL_TARGET_##ISA() static void gram_##K##_##ISA(double *HtH, double **H, const int rows, const int k)         \
+    {                                                                                                                \
+        double acc[K * K], *H_i;                                                                                     \
+        int i, l, c;                                                                                                 \
+        (void)k;                                                                                                     \
+        for (l = 0; l < K * K; l++)                                                                                  \
+            acc[l] = 0;                                                                                              \
+        for (i = 0; i < rows; i++)                                                                                   \
+        {                                                                                                            \
+            H_i = H[i];                                                                                              \
+            for (l = 0; l < K; l++)                                                                                  \
+            {                                                                                                        \
+                for (c = 0; c < K; c++)                                                                              \
+                    acc[l * K + c] += H_i[l] * H_i[c];                                                               \
+            }                                                                                                        \
+        }                                                                                                            \
+        memcpy(HtH, acc, sizeof(acc));                                                                               \
+    }                                                                                                                \
+                                                                                                                     \
+    KERNEL_TARGET_##ISA() static void mul_rows_##K##_##ISA(double **out, double **W, double **H, const int N,        \
+                                                           const int lo, const int hi, const int k)                  \
+    {                                                                                                                \
+        double acc[K], w, *W_i, *H_j;                                                                                \
+        int i, j, c;                                                                                                 \
+        (void)k;                                                                                                     \
+        for (i = lo; i < hi; i++)                                                                                    \
+        {                                                                                                            \
+            W_i = W[i];                                                                                              \
+            for (c = 0; c < K; c++)                                                                                  \
+                acc[c] = 0;                                                                                          \
+            for (j = 0; j < N; j++)                                                                                  \
+            {                                                                                                        \
+                w = W_i[j];                                                                                          \
+                H_j = H[j];                                                                                          \
+                for (c = 0; c < K; c++)                                                                              \
+                    acc[c] += w * H_j[c];                                                                            \
+            }                                                                                                        \
+            memcpy(out[i - lo], acc, sizeof(acc));                                                                   \
+        }                                                                                                            \
+    }                                                                                                                \
+                                                                                                                     \
+    KERNEL_TARGET_##ISA() static int update_rows_##K##_##ISA(double **out, double **W, double **H, const int N,      \
+                                                             const double *HtH, const int lo, const int hi,          \
+                                                             const int k, const double beta, double *stats)          \
+    {                                                                                                                \
+        double num[K], den[K], w, diff, *W_i, *H_i, *H_j;                                                            \
+        int i, j, l, c;                                                                                              \
+        (void)k;                                                                                                     \
+        for (i = lo; i < hi; i++)                                                                                    \
+        {                                                                                                            \
+            W_i = W[i];                                                                                              \
+            H_i = H[i];                                                                                              \
+            for (c = 0; c < K; c++)                                                                                  \
+            {                                                                                                        \
+                num[c] = 0;                                                                                          \
+                den[c] = 0;                                                                                          \
+            }                                                                                                        \
+            for (j = 0; j < N; j++)                                                                                  \
+            {                                                                                                        \
+                w = W_i[j];                                                                                          \
+                H_j = H[j];                                                                                          \
+                for (c = 0; c < K; c++)                                                                              \
+                    num[c] += w * H_j[c];                                                                            \
+            }                                                                                                        \
+            for (l = 0; l < K; l++)                                                                                  \
+            {                                                                                                        \
+                for (c = 0; c < K; c++)                                                                              \
+                    den[c] += H_i[l] * HtH[l * K + c];                                                               \
+            }                                                                                                        \
+            for (c = 0; c < K; c++)                                                                                  \
+            {                                                                                                        \
+                if (den[c] == 0)                                                                                     \
+                    return 1;                                                                                        \
+                out[i - lo][c] = H_i[c] * (1 - beta + beta * (num[c] / den[c]));                                     \
+                if (stats != NULL)                                                                                   \
+                {                                                                                                    \
+                    diff = out[i - lo][c] - H_i[c];                                                                  \
+                    stats[0] += H_i[c] * num[c];                                                                     \
+                    stats[1] += diff * diff;                                                                         \
+                }                                                                                                    \
+            }                                                                                                        \
+        }                                                                                                            \
+        return 0;                                                                                                    \
+    }
+
+#define DEFINE_KERNEL_SET(ISA)                                                                                       \
+    DEFINE_KERNELS(2, ISA)                                                                                           \
+    DEFINE_KERNELS(3, ISA)                                                                                           \
+    DEFINE_KERNELS(4, ISA)                                                                                           \
+    DEFINE_KERNELS(8, ISA)                                                                                           \
+    DEFINE_KERNELS(16, ISA)
+
+#define KERNEL_TABLE(ISA)                                                                                            \
+    {                                                                                                                \
+        {2, gram_2_##ISA, mul_rows_2_##ISA, update_rows_2_##ISA},                                                    \
+        {3, gram_3_##ISA, mul_rows_3_##ISA, update_rows_3_##ISA},                                                    \
+        {4, gram_4_##ISA, mul_rows_4_##ISA, update_rows_4_##ISA},                                                    \
+        {8, gram_8_##ISA, mul_rows_8_##ISA, update_rows_8_##ISA},                                                    \
+        {16, gram_16_##ISA, mul_rows_16_##ISA, update_rows_16_##ISA}                                                 \
+    }
+
+#define N_SPECIALIZATIONS 5
+
+#define KERNEL_TARGET_generic()
+DEFINE_KERNEL_SET(generic)
+
+/* kernel_tables[level] holds the specializations built for the isa_level 'level' */
+#ifdef ISA_X86
+#define KERNEL_TARGET_avx2() ISA_TARGET_AVX2
+#define KERNEL_TARGET_avx512() ISA_TARGET_AVX512
+DEFINE_KERNEL_SET(avx2)
+DEFINE_KERNEL_SET(avx512)
+
+static const symnmf_kernels kernel_tables[][N_SPECIALIZATIONS] = {
+    KERNEL_TABLE(generic), KERNEL_TABLE(avx2), KERNEL_TABLE(avx512)};
+#else
+static const symnmf_kernels kernel_tables[][N_SPECIALIZATIONS] = {KERNEL_TABLE(generic)};
+#endif
+
+static const symnmf_kernels generic_kernels = {0, gram_generic, mul_rows_generic, update_rows_generic};
+
+/*
+ * Returns the kernels specialized for 'k' clusters in the instruction set chosen by isa_select,
+ * or the generic kernels if there is no specialization.
+ */
+const symnmf_kernels *select_kernels(const int k)
+{
+    const symnmf_kernels *table = kernel_tables[isa_select()->level];
+    int i, mask = tuning_current()->generic_mask;
+    for (i = 0; i < N_SPECIALIZATIONS; i++)
+    {
+        if (table[i].k == k && !(k < 31 && (mask >> k) & 1))
+            return &table[i];
+    }
+    return &generic_kernels;
+}
@@ -0,0 +1,31 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+/*
+ * Row kernels of the SymNMF update, specialized at build time for small cluster counts k.
+ * 'HtH' is the k x k matrix H^T * H stored row after row.
+ */
+typedef struct symnmf_kernels
+{
+    /* k of the specialization, 0 for the generic kernels */
+    int k;
+
+    /* HtH = H^T * H over the 'rows' rows of 'H' */
+    void (*gram)(double *HtH, double **H, const int rows, const int k);
+
+    /* out[i - lo] = (W * H)_i for the rows i in ['lo', 'hi') */
+    void (*mul_rows)(double **out, double **W, double **H, const int N, const int lo, const int hi, const int k);
+
+    /*
+     * out[i - lo] = H_i * (1 - beta + beta * (W * H)_i / (H * HtH)_i) for the rows i in ['lo', 'hi').
+     * Unless 'stats' is NULL, also adds H_i . (W * H)_i to stats[0] and ||out[i - lo] - H_i||^2 to stats[1],
+     * so a full update yields trace(H^T * W * H) and the squared step with no pass of its own.
+     * Returns 0 on success, 1 on division by zero.
+     */
+    int (*update_rows)(double **out, double **W, double **H, const int N, const double *HtH,
+                       const int lo, const int hi, const int k, const double beta, double *stats);
+} symnmf_kernels;
+
+const symnmf_kernels *select_kernels(const int k);
+
+#endif
@@ -0,0 +1,802 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symnmf.h"
+#include "knn.h"
+#include "isa.h"
+#include "kernels.h"
+
+/*
+ * k nearest neighbour graphs in about O(N log N) distance evaluations instead of the O(N^2) of C_sym,
+ * and the sparse normalized similarity matrix built on them.
+ * Low dimensional points go through a KD-tree, where 'effort' bounds the leaves a query visits.
+ * High dimensional points go through NN-descent, where 'effort' is the list size kept per point while
+ * descending, at least 'k'; longer lists cost more distances and reach a higher recall.
+ * 'effort' == 0 asks for the exact search of the KD-tree, and for KNN_NND_LIST_SCALE * 'k' long lists.
+ */
+
+/*
+ * Bounded max-heap of (distance, index) pairs holding the 'k' nearest candidates seen so far,
+ * the farthest of them at the root. 'is_new' (may be NULL) is permuted along with the pairs.
+ */
+
+static void heap_swap(int *idx, double *dist, unsigned char *is_new, const int a, const int b)
+{
+    int t = idx[a];
+    double s = dist[a];
+    unsigned char f;
+
+    idx[a] = idx[b];
+    idx[b] = t;
+    dist[a] = dist[b];
+    dist[b] = s;
+    if (is_new != NULL)
+    {
+        f = is_new[a];
+        is_new[a] = is_new[b];
+        is_new[b] = f;
+    }
+}
+
+/*
+ * Offers neighbour 'j' at squared distance 'd' to the heap of size '*size'.
+ * Returns 1 if it was taken.
+ */
+static int heap_offer(int *idx, double *dist, unsigned char *is_new, int *size, const int k,
+                      const int j, const double d)
+{
+    int c, l, r, big;
+
+    if (*size < k)
+    {
+        c = (*size)++;
+        idx[c] = j;
+        dist[c] = d;
+        if (is_new != NULL)
+            is_new[c] = 1;
+        while (c > 0 && dist[(c - 1) / 2] < dist[c])
+        {
+            heap_swap(idx, dist, is_new, c, (c - 1) / 2);
+            c = (c - 1) / 2;
+        }
+        return 1;
+    }
+    if (d >= dist[0])
+        return 0;
+
+    idx[0] = j;
+    dist[0] = d;
+    if (is_new != NULL)
+        is_new[0] = 1;
+    c = 0;
+    while (1)
+    {
+        l = 2 * c + 1;
+        r = l + 1;
+        big = c;
+        if (l < k && dist[l] > dist[big])
+            big = l;
+        if (r < k && dist[r] > dist[big])
+            big = r;
+        if (big == c)
+            break;
+        heap_swap(idx, dist, is_new, c, big);
+        c = big;
+    }
+    return 1;
+}
+
+/*
+ * Sorts the 'k' pairs of a row nearest first.
+ */
+static void sort_row(int *idx, double *dist, const int k)
+{
+    int a, b, t;
+    double s;
+
+    for (a = 1; a < k; a++)
+    {
+        t = idx[a];
+        s = dist[a];
+        for (b = a; b > 0 && dist[b - 1] > s; b--)
+        {
+            idx[b] = idx[b - 1];
+            dist[b] = dist[b - 1];
+        }
+        idx[b] = t;
+        dist[b] = s;
+    }
+}
+
+/*
+ * Allocates the lists of '*G'.
+ * Returns 0 on success.
+ */
+static int alloc_knn(knn_graph *G, const int N, const int k)
+{
+    G->N = N;
+    G->k = k;
+    G->idx = (int *)malloc((size_t)N * k * sizeof(int));
+    G->dist2 = (double *)malloc((size_t)N * k * sizeof(double));
+    if (G->idx == NULL || G->dist2 == NULL)
+    {
+        free_knn(G);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * KD-tree over a permutation of the points. A node owns 'perm[lo .. hi)'; inner nodes split it at
+ * the median of coordinate 'dim', points left of 'mid' having coordinate <= 'split' and the
+ * others >= 'split'. Leaves have 'left' == -1.
+ */
+typedef struct kd_node
+{
+    int lo, hi, dim, left, right;
+    double split;
+} kd_node;
+
+typedef struct kd_tree
+{
+    kd_node *nodes;
+    int n_nodes;
+    int *perm;
+    double **X;
+    int d;
+} kd_tree;
+
+/*
+ * Nearest neighbour search state of the point 'self' at 'q'.
+ */
+typedef struct kd_query
+{
+    const double *q;
+    int self, k, size, leaves, max_leaves;
+    int *idx;
+    double *dist2;
+} kd_query;
+
+/*
+ * Reorders 'perm[lo .. hi)' so 'perm[nth]' holds the point of rank 'nth' in coordinate 'dim'.
+ * Hoare partitioning, so runs of equal coordinates split evenly instead of going quadratic.
+ */
+static void kd_select(kd_tree *T, int lo, int hi, const int nth, const int dim)
+{
+    int i, j, t;
+    double pivot;
+
+    hi--;
+    while (lo < hi)
+    {
+        pivot = T->X[T->perm[nth]][dim];
+        i = lo;
+        j = hi;
+        do
+        {
+            while (T->X[T->perm[i]][dim] < pivot)
+                i++;
+            while (pivot < T->X[T->perm[j]][dim])
+                j--;
+            if (i <= j)
+            {
+                t = T->perm[i];
+                T->perm[i++] = T->perm[j];
+                T->perm[j--] = t;
+            }
+        } while (i <= j);
+        if (j < nth)
+            lo = i;
+        if (nth < i)
+            hi = j;
+    }
+}
+
+/*
+ * Builds the subtree over 'perm[lo .. hi)', split on the coordinate of largest spread.
+ * Returns the index of its root node.
+ */
+static int kd_build(kd_tree *T, const int lo, const int hi)
+{
+    int node = T->n_nodes++, i, l, mid;
+    double lo_v, hi_v, spread = -1, v;
+    kd_node *n = &T->nodes[node];
+
+    n->lo = lo;
+    n->hi = hi;
+    n->left = -1;
+    n->right = -1;
+    if (hi - lo <= KNN_LEAF_SIZE)
+        return node;
+
+    n->dim = 0;
+    for (l = 0; l < T->d; l++)
+    {
+        lo_v = hi_v = T->X[T->perm[lo]][l];
+        for (i = lo + 1; i < hi; i++)
+        {
+            v = T->X[T->perm[i]][l];
+            if (v < lo_v)
+                lo_v = v;
+            if (v > hi_v)
+                hi_v = v;
+        }
+        if (hi_v - lo_v > spread)
+        {
+            spread = hi_v - lo_v;
+            n->dim = l;
+        }
+    }
+
+    mid = (lo + hi) / 2;
+    kd_select(T, lo, hi, mid, n->dim);
+    n->split = T->X[T->perm[mid]][n->dim];
+
+    /* 'n' may move no more, 'T->nodes' is allocated up front */
+    n->left = kd_build(T, lo, mid);
+    n->right = kd_build(T, mid, hi);
+    return node;
+}
+
+/*
+ * Depth first search nearest side first, skipping far sides the current k-th distance rules out.
+ * Stops descending once 'Q->max_leaves' leaves were scanned, if 'Q->max_leaves' > 0.
+ */
+static void kd_search(kd_tree *T, const int node, kd_query *Q,
+                      double (*dist2)(const double *, const double *, const int))
+{
+    kd_node *n = &T->nodes[node];
+    double diff;
+    int i, near, far;
+
+    if (n->left < 0)
+    {
+        Q->leaves++;
+        for (i = n->lo; i < n->hi; i++)
+        {
+            if (T->perm[i] != Q->self)
+                heap_offer(Q->idx, Q->dist2, NULL, &Q->size, Q->k, T->perm[i],
+                           dist2(Q->q, T->X[T->perm[i]], T->d));
+        }
+        return;
+    }
+
+    diff = Q->q[n->dim] - n->split;
+    near = diff < 0 ? n->left : n->right;
+    far = diff < 0 ? n->right : n->left;
+    kd_search(T, near, Q, dist2);
+    if (Q->max_leaves > 0 && Q->leaves >= Q->max_leaves)
+        return;
+    if (Q->size < Q->k || diff * diff < Q->dist2[0])
+        kd_search(T, far, Q, dist2);
+}
+
+static int knn_kdtree(knn_graph *G, double ***X, const int N, const int d, const int k, const int effort)
+{
+    const isa_kernels *isa = isa_select();
+    kd_tree T;
+    kd_query Q;
+    int i;
+
+    T.nodes = (kd_node *)malloc(2 * (size_t)N * sizeof(kd_node));
+    T.perm = (int *)malloc(N * sizeof(int));
+    if (T.nodes == NULL || T.perm == NULL)
+    {
+        free(T.nodes);
+        free(T.perm);
+        return 1;
+    }
+    T.n_nodes = 0;
+    T.X = *X;
+    T.d = d;
+    for (i = 0; i < N; i++)
+        T.perm[i] = i;
+    kd_build(&T, 0, N);
+
+    Q.k = k;
+    Q.max_leaves = effort;
+    for (i = 0; i < N; i++)
+    {
+        Q.q = (*X)[i];
+        Q.self = i;
+        Q.size = 0;
+        Q.leaves = 0;
+        Q.idx = G->idx + (size_t)i * k;
+        Q.dist2 = G->dist2 + (size_t)i * k;
+        kd_search(&T, 0, &Q, isa->dist2);
+
+        /* A leaf budget below k / KNN_LEAF_SIZE can leave the list short, keep searching unbounded */
+        if (Q.size < k)
+        {
+            Q.max_leaves = 0;
+            Q.size = 0;
+            kd_search(&T, 0, &Q, isa->dist2);
+            Q.max_leaves = effort;
+        }
+        sort_row(Q.idx, Q.dist2, k);
+    }
+
+    free(T.nodes);
+    free(T.perm);
+    return 0;
+}
+
+/*
+ * Returns 1 if 'j' is among the 'k' entries of 'idx'.
+ */
+static int contains(const int *idx, const int k, const int j)
+{
+    int c;
+    for (c = 0; c < k; c++)
+    {
+        if (idx[c] == j)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Adds 'j' to the candidate list 'list' of capacity 'k' and length '*len', replacing a random
+ * entry once it is full so every offer has about the same chance to stay.
+ */
+static void sample_into(int *list, int *len, const int k, const int j, unsigned long *state)
+{
+    unsigned long r;
+    if (*len < k)
+    {
+        list[(*len)++] = j;
+        return;
+    }
+    r = lcg_next(state) % (unsigned long)(2 * k);
+    if (r < (unsigned long)k)
+        list[r] = j;
+}
+
+/*
+ * NN-descent: starting from random lists, a neighbour of a neighbour is likely a neighbour.
+ * Each round joins, for every point, the new and old entries of its forward and reverse lists.
+ * The lists hold 'K' >= 'k' entries while descending, so a true neighbour pushed out of the nearest 'k'
+ * can still come back through a join; only the nearest 'k' of each are kept in '*G'.
+ */
+static int knn_descent(knn_graph *G, double ***X, const int N, const int d, const int k, const int K,
+                       unsigned long seed)
+{
+    double (*dist2)(const double *, const double *, const int) = isa_select()->dist2;
+    int *size, *new_list, *old_list, *n_new, *n_old, i, j, c, a, b, u, v, iter, updates;
+    unsigned char *is_new;
+    double dd;
+    knn_graph L;
+
+    if (alloc_knn(&L, N, K) != 0)
+        return 1;
+    size = (int *)calloc(N, sizeof(int));
+    n_new = (int *)calloc(N, sizeof(int));
+    n_old = (int *)calloc(N, sizeof(int));
+    new_list = (int *)malloc((size_t)N * 2 * K * sizeof(int));
+    old_list = (int *)malloc((size_t)N * 2 * K * sizeof(int));
+    is_new = (unsigned char *)malloc((size_t)N * K);
+    if (size == NULL || n_new == NULL || n_old == NULL || new_list == NULL || old_list == NULL || is_new == NULL)
+    {
+        free_knn(&L);
+        free(size);
+        free(n_new);
+        free(n_old);
+        free(new_list);
+        free(old_list);
+        free(is_new);
+        return 1;
+    }
+
+    /* K distinct random neighbours per point */
+    for (i = 0; i < N; i++)
+    {
+        while (size[i] < K)
+        {
+            j = (int)(lcg_next(&seed) % (unsigned long)N);
+            if (j != i && !contains(L.idx + (size_t)i * K, size[i], j))
+                heap_offer(L.idx + (size_t)i * K, L.dist2 + (size_t)i * K, is_new + (size_t)i * K, &size[i], K,
+                           j, dist2((*X)[i], (*X)[j], d));
+        }
+    }
+
+    for (iter = 0; iter < KNN_NND_MAX_ITERS; iter++)
+    {
+        /* Candidate lists: forward entries, then reverse entries sampled down to K */
+        for (i = 0; i < N; i++)
+        {
+            n_new[i] = 0;
+            n_old[i] = 0;
+            for (c = 0; c < K; c++)
+            {
+                j = L.idx[(size_t)i * K + c];
+                if (is_new[(size_t)i * K + c])
+                    new_list[(size_t)i * 2 * K + n_new[i]++] = j;
+                else
+                    old_list[(size_t)i * 2 * K + n_old[i]++] = j;
+                is_new[(size_t)i * K + c] = 0;
+            }
+        }
+        for (i = 0; i < N; i++)
+        {
+            for (c = 0; c < K; c++)
+            {
+                j = L.idx[(size_t)i * K + c];
+                if (contains(new_list + (size_t)i * 2 * K, n_new[i], j))
+                    sample_into(new_list + (size_t)j * 2 * K, &n_new[j], 2 * K, i, &seed);
+                else
+                    sample_into(old_list + (size_t)j * 2 * K, &n_old[j], 2 * K, i, &seed);
+            }
+        }
+
+        /* Local join: every new-new and new-old pair around v may improve both lists */
+        updates = 0;
+        for (v = 0; v < N; v++)
+        {
+            for (a = 0; a < n_new[v]; a++)
+            {
+                u = new_list[(size_t)v * 2 * K + a];
+                for (b = a + 1; b < n_new[v] + n_old[v]; b++)
+                {
+                    j = b < n_new[v] ? new_list[(size_t)v * 2 * K + b] : old_list[(size_t)v * 2 * K + b - n_new[v]];
+                    if (j == u)
+                        continue;
+                    dd = dist2((*X)[u], (*X)[j], d);
+                    if (!contains(L.idx + (size_t)u * K, K, j))
+                        updates += heap_offer(L.idx + (size_t)u * K, L.dist2 + (size_t)u * K,
+                                              is_new + (size_t)u * K, &size[u], K, j, dd);
+                    if (!contains(L.idx + (size_t)j * K, K, u))
+                        updates += heap_offer(L.idx + (size_t)j * K, L.dist2 + (size_t)j * K,
+                                              is_new + (size_t)j * K, &size[j], K, u, dd);
+                }
+            }
+        }
+        if (updates < KNN_NND_DELTA * N * K)
+            break;
+    }
+
+    for (i = 0; i < N; i++)
+    {
+        sort_row(L.idx + (size_t)i * K, L.dist2 + (size_t)i * K, K);
+        memcpy(G->idx + (size_t)i * k, L.idx + (size_t)i * K, k * sizeof(int));
+        memcpy(G->dist2 + (size_t)i * k, L.dist2 + (size_t)i * K, k * sizeof(double));
+    }
+
+    free_knn(&L);
+    free(size);
+    free(n_new);
+    free(n_old);
+    free(new_list);
+    free(old_list);
+    free(is_new);
+    return 0;
+}
+
+/*
+ * Calculate the 'k' nearest neighbours of every point of '*X' and place them in '*G'.
+ * Returns 0 on success.
+ *
+ * 'X' - Address of 2D matrix that contains 'rows_X' vectors, each having a size of 'cols_X'.
+ * 'k' - Neighbours per point, 1 <= 'k' < 'rows_X'.
+ * 'effort' - Leaves per query (KD-tree) or list size (NN-descent, raised to 'k'), 0 for the defaults above.
+ * 'seed' - Seed of the NN-descent starting lists.
+ */
+int C_knn(knn_graph *G, double ***X, const int rows_X, const int cols_X, const int k,
+          const int effort, const unsigned long seed)
+{
+    int K;
+
+    if (k < 1 || k >= rows_X || effort < 0)
+        return 1;
+    if (alloc_knn(G, rows_X, k) != 0)
+        return 1;
+    K = effort > 0 ? effort : KNN_NND_LIST_SCALE * k;
+    K = K < k ? k : K > rows_X - 1 ? rows_X - 1 : K;
+    if ((cols_X <= KNN_KDTREE_MAX_DIM ? knn_kdtree(G, X, rows_X, cols_X, k, effort)
+                                      : knn_descent(G, X, rows_X, cols_X, k, K, seed)) != 0)
+    {
+        free_knn(G);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Calculate the exact 'k' nearest neighbours of every point of '*X' by brute force, in O(N^2 * d).
+ * Returns 0 on success.
+ */
+int C_knn_brute(knn_graph *G, double ***X, const int rows_X, const int cols_X, const int k)
+{
+    double (*dist2)(const double *, const double *, const int) = isa_select()->dist2;
+    int i, j, size;
+
+    if (k < 1 || k >= rows_X)
+        return 1;
+    if (alloc_knn(G, rows_X, k) != 0)
+        return 1;
+    for (i = 0; i < rows_X; i++)
+    {
+        size = 0;
+        for (j = 0; j < rows_X; j++)
+        {
+            if (j != i)
+                heap_offer(G->idx + (size_t)i * k, G->dist2 + (size_t)i * k, NULL, &size, k, j,
+                           dist2((*X)[i], (*X)[j], cols_X));
+        }
+        sort_row(G->idx + (size_t)i * k, G->dist2 + (size_t)i * k, k);
+    }
+    return 0;
+}
+
+/*
+ * Returns the fraction of the true neighbours in '*exact' that '*G' found.
+ */
+double knn_recall(knn_graph *G, knn_graph *exact)
+{
+    long found = 0;
+    int i, c;
+
+    for (i = 0; i < G->N; i++)
+    {
+        for (c = 0; c < G->k; c++)
+            found += contains(exact->idx + (size_t)i * G->k, G->k, G->idx[(size_t)i * G->k + c]);
+    }
+    return (double)found / ((double)G->N * G->k);
+}
+
+/*
+ * Free the dynamic memory of '*G'.
+ */
+void free_knn(knn_graph *G)
+{
+    free(G->idx);
+    free(G->dist2);
+    G->idx = NULL;
+    G->dist2 = NULL;
+}
+
+/* One entry of a CSR row while it is sorted, 'pos' keeps the sort stable */
+typedef struct row_entry
+{
+    int col, pos;
+    double val;
+} row_entry;
+
+static int by_column(const void *a, const void *b)
+{
+    const row_entry *x = (const row_entry *)a, *y = (const row_entry *)b;
+    if (x->col != y->col)
+        return x->col < y->col ? -1 : 1;
+    return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+/*
+ * Calculate the normalized similarity matrix restricted to the symmetrized kNN graph '*G' and
+ * place it in '*S': w_ij = a_ij / sqrt(d_i * d_j) where j is a neighbour of i or i of j,
+ * with a_ij and the degrees d_i as in C_sym and C_ddg over those pairs only.
+ * Returns 0 on success.
+ */
+int C_knn_norm(sparse_graph *S, knn_graph *G)
+{
+    int N = G->N, k = G->k, i, j, c, p, q, len, max_len, *fill;
+    double *deg, w;
+    row_entry *row;
+
+    S->N = N;
+    S->row_ptr = (int *)calloc(N + 1, sizeof(int));
+    S->col = (int *)malloc((size_t)2 * N * k * sizeof(int));
+    S->val = (double *)malloc((size_t)2 * N * k * sizeof(double));
+    fill = (int *)malloc(N * sizeof(int));
+    deg = (double *)calloc(N, sizeof(double));
+    if (S->row_ptr == NULL || S->col == NULL || S->val == NULL || fill == NULL || deg == NULL)
+    {
+        free(fill);
+        free(deg);
+        free_sparse(S);
+        return 1;
+    }
+
+    /* Every kNN edge i -> j lands in rows i and j, duplicates are merged below */
+    for (i = 0; i < N; i++)
+    {
+        for (c = 0; c < k; c++)
+        {
+            S->row_ptr[i + 1]++;
+            S->row_ptr[G->idx[(size_t)i * k + c] + 1]++;
+        }
+    }
+    max_len = 0;
+    for (i = 0; i < N; i++)
+    {
+        if (S->row_ptr[i + 1] > max_len)
+            max_len = S->row_ptr[i + 1];
+        S->row_ptr[i + 1] += S->row_ptr[i];
+        fill[i] = S->row_ptr[i];
+    }
+    row = (row_entry *)malloc((max_len > 0 ? max_len : 1) * sizeof(row_entry));
+    if (row == NULL)
+    {
+        free(fill);
+        free(deg);
+        free_sparse(S);
+        return 1;
+    }
+    for (i = 0; i < N; i++)
+    {
+        for (c = 0; c < k; c++)
+        {
+            j = G->idx[(size_t)i * k + c];
+            w = exp(-SYM_KERNEL_SCALE * G->dist2[(size_t)i * k + c]);
+            S->col[fill[i]] = j;
+            S->val[fill[i]++] = w;
+            S->col[fill[j]] = i;
+            S->val[fill[j]++] = w;
+        }
+    }
+
+    /*
+     * Sort every row by column and compact it, keeping one copy of edges found from both ends.
+     * A row holds the k neighbours of the point plus every point that has it as a neighbour, so hubs
+     * can be long and are sorted in O(deg log deg).
+     */
+    q = 0;
+    for (i = 0; i < N; i++)
+    {
+        p = S->row_ptr[i];
+        len = fill[i] - p;
+        for (c = 0; c < len; c++)
+        {
+            row[c].col = S->col[p + c];
+            row[c].pos = c;
+            row[c].val = S->val[p + c];
+        }
+        qsort(row, len, sizeof(row_entry), by_column);
+        S->row_ptr[i] = q;
+        for (c = 0; c < len; c++)
+        {
+            if (q > S->row_ptr[i] && S->col[q - 1] == row[c].col)
+                continue;
+            S->col[q] = row[c].col;
+            S->val[q++] = row[c].val;
+            deg[i] += row[c].val;
+        }
+    }
+    S->row_ptr[N] = q;
+    free(fill);
+    free(row);
+
+    for (i = 0; i < N; i++)
+    {
+        if (deg[i] == 0)
+        {
+            /* Every affinity of the point underflowed, its row can not be normalized */
+            free(deg);
+            free_sparse(S);
+            return 1;
+        }
+    }
+    for (i = 0; i < N; i++)
+    {
+        for (p = S->row_ptr[i]; p < S->row_ptr[i + 1]; p++)
+            S->val[p] /= sqrt(deg[i] * deg[S->col[p]]);
+    }
+    free(deg);
+    return 0;
+}
+
+/*
+ * Calculate W * H for the sparse W '*S', in O(nnz * k), and place it in '*result'.
+ * pre: '*result' is dynamically allocated with dimensions 'S->N' x 'cols_H', its contents are overwritten.
+ * Returns 0 on success.
+ *
+ * 'H' - Address of a 2D array with dimensions 'S->N' x 'cols_H'.
+ */
+int sparse_mul(double ***result, sparse_graph *S, double ***H, const int cols_H)
+{
+    int i, p, c;
+    double w, *H_j;
+
+    for (i = 0; i < S->N; i++)
+    {
+        memset((*result)[i], 0, cols_H * sizeof(double));
+        for (p = S->row_ptr[i]; p < S->row_ptr[i + 1]; p++)
+        {
+            w = S->val[p];
+            H_j = (*H)[S->col[p]];
+            for (c = 0; c < cols_H; c++)
+                (*result)[i][c] += w * H_j[c];
+        }
+    }
+    return 0;
+}
+
+/*
+ * Returns the mean entry of the sparse W, zeros included, used to scale the initial H.
+ */
+double sparse_mean(sparse_graph *S)
+{
+    double total = 0;
+    int p;
+    for (p = 0; p < S->row_ptr[S->N]; p++)
+        total += S->val[p];
+    return total / ((double)S->N * S->N);
+}
+
+/*
+ * Calculate the optimal 'H_out' matrix from the initial 'H_in' for the sparse W '*S'.
+ * Each iteration costs O((nnz + N * k) * k).
+ * pre: '*H_out' is NOT dynamically allocated.
+ * Returns 0 on success.
+ *
+ * 'H_out', 'H_in' - Address of a 2D array with dimensions 'rows_H' x 'cols_H'.
+ */
+int C_symnmf_sparse(double ***H_out, double ***H_in, const int rows_H, const int cols_H, sparse_graph *S)
+{
+    const symnmf_kernels *kernels = select_kernels(cols_H);
+    double **NUM, *HtH, den, diff, delta;
+    int iter, i, l, c;
+
+    if (rows_H != S->N)
+        return 1;
+    HtH = (double *)malloc((size_t)cols_H * cols_H * sizeof(double));
+    if (HtH == NULL)
+        return 1;
+    if (allocate_2D_array(H_out, rows_H, cols_H) != 0)
+    {
+        free(HtH);
+        return 1;
+    }
+    /* W * H, one buffer reused by every iteration */
+    if (allocate_2D_array(&NUM, rows_H, cols_H) != 0)
+    {
+        free(HtH);
+        free_2D_array(H_out, rows_H);
+        return 1;
+    }
+
+    delta = EPS + 1;
+    for (iter = 0; iter < MAX_ITER && delta >= EPS; iter++)
+    {
+        sparse_mul(&NUM, S, H_in, cols_H);
+        kernels->gram(HtH, *H_in, rows_H, cols_H);
+
+        delta = 0;
+        for (i = 0; i < rows_H; i++)
+        {
+            for (c = 0; c < cols_H; c++)
+            {
+                den = 0;
+                for (l = 0; l < cols_H; l++)
+                    den += (*H_in)[i][l] * HtH[l * cols_H + c];
+                if (den == 0)
+                {
+                    /* Division by zero */
+                    free_2D_array(&NUM, rows_H);
+                    free(HtH);
+                    free_2D_array(H_out, rows_H);
+                    return 1;
+                }
+                (*H_out)[i][c] = (*H_in)[i][c] * (1 - BETA + BETA * (NUM[i][c] / den));
+                diff = (*H_out)[i][c] - (*H_in)[i][c];
+                delta += diff * diff;
+            }
+        }
+        copy_matrix(H_in, H_out, rows_H, cols_H);
+    }
+
+    free_2D_array(&NUM, rows_H);
+    free(HtH);
+    return 0;
+}
+
+/*
+ * Free the dynamic memory of '*S'.
+ */
+void free_sparse(sparse_graph *S)
+{
+    free(S->row_ptr);
+    free(S->col);
+    free(S->val);
+    S->row_ptr = NULL;
+    S->col = NULL;
+    S->val = NULL;
+}
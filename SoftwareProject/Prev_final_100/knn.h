@@ -0,0 +1,59 @@
+#ifndef KNN_H
+#define KNN_H
+
+/* Points of at most KNN_KDTREE_MAX_DIM coordinates are indexed by a KD-tree, others by NN-descent */
+#define KNN_KDTREE_MAX_DIM 16
+
+/* Points per KD-tree leaf */
+#define KNN_LEAF_SIZE 16
+
+/* NN-descent stops after KNN_NND_MAX_ITERS rounds, or once a round changes fewer than KNN_NND_DELTA * N * K lists */
+#define KNN_NND_MAX_ITERS 12
+#define KNN_NND_DELTA 0.001
+
+/* NN-descent keeps lists of KNN_NND_LIST_SCALE * k while descending unless 'effort' sets their size */
+#define KNN_NND_LIST_SCALE 2
+
+/*
+ * The 'k' nearest neighbours of each of 'N' points, nearest first.
+ * Neighbour 'c' of point 'i' is 'idx[i * k + c]', at squared distance 'dist2[i * k + c]'.
+ */
+typedef struct knn_graph
+{
+    int N, k;
+    int *idx;
+    double *dist2;
+} knn_graph;
+
+/*
+ * Symmetric 'N' x 'N' sparse matrix in CSR form: the nonzeros of row 'i' are
+ * 'val[row_ptr[i] .. row_ptr[i + 1])' in the columns 'col[row_ptr[i] .. row_ptr[i + 1])'.
+ */
+typedef struct sparse_graph
+{
+    int N;
+    int *row_ptr;
+    int *col;
+    double *val;
+} sparse_graph;
+
+int C_knn(knn_graph *G, double ***X, const int rows_X, const int cols_X, const int k,
+          const int effort, const unsigned long seed);
+
+int C_knn_brute(knn_graph *G, double ***X, const int rows_X, const int cols_X, const int k);
+
+double knn_recall(knn_graph *G, knn_graph *exact);
+
+void free_knn(knn_graph *G);
+
+int C_knn_norm(sparse_graph *S, knn_graph *G);
+
+int sparse_mul(double ***result, sparse_graph *S, double ***H, const int cols_H);
+
+double sparse_mean(sparse_graph *S);
+
+int C_symnmf_sparse(double ***H_out, double ***H_in, const int rows_H, const int cols_H, sparse_graph *S);
+
+void free_sparse(sparse_graph *S);
+
+#endif
@@ -0,0 +1,338 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symnmf.h"
+#include "nystrom.h"
+#include "isa.h"
+#include "kernels.h"
+
+/*
+ * Nystrom approximation of the similarity matrix.
+ * With m sampled landmarks L, A ~= C * A_LL^+ * C^T where C (N x m) holds the affinities to the landmarks.
+ * Writing A_LL = U * diag(lambda) * U^T, A ~= F * F^T with F = C * U * diag(lambda)^(-1/2), so the degree
+ * vector, W and W * H are all formed through F and the N x N matrices are never built.
+ */
+
+/*
+ * Picks 'm' distinct indices out of [0, 'N') and place them in '*landmarks'.
+ * pre: '*landmarks' is NOT dynamically allocated.
+ * Returns 0 on success.
+ */
+static int sample_landmarks(int **landmarks, const int N, const int m, unsigned long *state)
+{
+    int *perm, i, j, t;
+
+    perm = (int *)malloc(N * sizeof(int));
+    if (perm == NULL)
+        return 1;
+    for (i = 0; i < N; i++)
+        perm[i] = i;
+
+    /* Partial Fisher-Yates shuffle, the first 'm' entries are the sample */
+    for (i = 0; i < m; i++)
+    {
+        j = i + (int)(lcg_next(state) % (unsigned long)(N - i));
+        t = perm[i];
+        perm[i] = perm[j];
+        perm[j] = t;
+    }
+    *landmarks = perm;
+    return 0;
+}
+
+/*
+ * Returns exp(-SYM_KERNEL_SCALE * ||'x' - 'y'||^2) for vectors of length 'd'.
+ */
+static double affinity(const double *x, const double *y, const int d)
+{
+    return exp(-SYM_KERNEL_SCALE * isa_select()->dist2(x, y, d));
+}
+
+/*
+ * Calculate the low-rank normalized similarity matrix of '*X' from 'm' random landmarks and place it in '*L'.
+ * Takes O(N * m * (d + m)) time and O(N * m) memory.
+ * Returns 0 on success.
+ *
+ * 'X' - Address of 2D matrix that contains 'rows_X' vectors, each having a size of 'cols_X'.
+ * 'm' - Number of landmarks, 1 <= 'm' <= 'rows_X'.
+ */
+int C_nystrom_norm(lowrank_graph *L, double ***X, const int rows_X, const int cols_X,
+                   const int m, const unsigned long seed)
+{
+    int N = rows_X, i, a, b, rank, *landmarks, *kept;
+    unsigned long state = seed;
+    double **C, **A_LL, **U, *lambda, *colsum, *row, lambda_max, deg;
+
+    if (m < 1 || m > N)
+        return 1;
+    if (sample_landmarks(&landmarks, N, m, &state) != 0)
+        return 1;
+
+    /* C = affinities of every point to the landmarks, the landmarks' own entries are a_ii == 1 */
+    if (allocate_2D_array(&C, N, m) != 0)
+    {
+        free(landmarks);
+        return 1;
+    }
+    for (i = 0; i < N; i++)
+    {
+        for (a = 0; a < m; a++)
+            C[i][a] = affinity((*X)[i], (*X)[landmarks[a]], cols_X);
+    }
+
+    if (allocate_2D_array(&A_LL, m, m) != 0)
+    {
+        free(landmarks);
+        free_2D_array(&C, N);
+        return 1;
+    }
+    for (a = 0; a < m; a++)
+        memcpy(A_LL[a], C[landmarks[a]], m * sizeof(double));
+    free(landmarks);
+
+    if (jacobi_eigen(&U, &lambda, &A_LL, m) != 0)
+    {
+        free_2D_array(&C, N);
+        free_2D_array(&A_LL, m);
+        return 1;
+    }
+    free_2D_array(&A_LL, m);
+
+    /* Keep the numerically positive part of the spectrum, scaling U by lambda^(-1/2) */
+    kept = (int *)malloc(m * sizeof(int));
+    row = (double *)malloc(m * sizeof(double));
+    if (kept == NULL || row == NULL)
+    {
+        free(kept);
+        free(row);
+        free_2D_array(&C, N);
+        free_2D_array(&U, m);
+        free(lambda);
+        return 1;
+    }
+    lambda_max = 0;
+    for (a = 0; a < m; a++)
+    {
+        if (lambda[a] > lambda_max)
+            lambda_max = lambda[a];
+    }
+    rank = 0;
+    for (a = 0; a < m; a++)
+    {
+        if (lambda[a] > NYSTROM_RCOND * lambda_max)
+            kept[rank++] = a;
+    }
+
+    /* F = C * U_kept * diag(lambda_kept)^(-1/2), computed in place row by row */
+    for (i = 0; i < N; i++)
+    {
+        for (b = 0; b < rank; b++)
+        {
+            row[b] = 0;
+            for (a = 0; a < m; a++)
+                row[b] += C[i][a] * U[a][kept[b]];
+            row[b] /= sqrt(lambda[kept[b]]);
+        }
+        memcpy(C[i], row, rank * sizeof(double));
+    }
+    free(kept);
+    free(row);
+    free_2D_array(&U, m);
+    free(lambda);
+
+    L->N = N;
+    L->rank = rank;
+    L->G = C;
+    L->s = (double *)malloc(N * sizeof(double));
+    colsum = (double *)calloc(rank > 0 ? rank : 1, sizeof(double));
+    if (L->s == NULL || colsum == NULL)
+    {
+        free(colsum);
+        free_lowrank(L);
+        return 1;
+    }
+
+    /* Degree d = F * (F^T * 1) - diag(F * F^T) */
+    for (i = 0; i < N; i++)
+    {
+        for (b = 0; b < rank; b++)
+            colsum[b] += C[i][b];
+    }
+    for (i = 0; i < N; i++)
+    {
+        deg = 0;
+        L->s[i] = 0;
+        for (b = 0; b < rank; b++)
+        {
+            deg += C[i][b] * colsum[b];
+            L->s[i] += C[i][b] * C[i][b];
+        }
+        deg -= L->s[i];
+        if (deg <= 0)
+        {
+            /* The approximation lost this point's neighbourhood */
+            free(colsum);
+            free_lowrank(L);
+            return 1;
+        }
+
+        /* G = D^(-1/2) * F and s = D^(-1/2) * diag(F * F^T) * D^(-1/2) */
+        for (b = 0; b < rank; b++)
+            C[i][b] /= sqrt(deg);
+        L->s[i] /= deg;
+    }
+    free(colsum);
+    return 0;
+}
+
+/*
+ * Calculate W * H through the low-rank factors, in O(N * rank * k), and place it in '*result'.
+ * pre: '*result' is dynamically allocated with dimensions 'L->N' x 'cols_H', and '*T' with dimensions
+ * max('L->rank', 1) x 'cols_H'; the contents of both are overwritten.
+ * Returns 0 on success.
+ *
+ * 'T' - Scratch for G^T * H.
+ * 'H' - Address of a 2D array with dimensions 'L->N' x 'cols_H'.
+ */
+int lowrank_mul(double ***result, double ***T, lowrank_graph *L, double ***H, const int cols_H)
+{
+    int i, b, c;
+
+    /* T = G^T * H, rank x k */
+    for (b = 0; b < L->rank; b++)
+        memset((*T)[b], 0, cols_H * sizeof(double));
+    for (i = 0; i < L->N; i++)
+    {
+        for (b = 0; b < L->rank; b++)
+        {
+            for (c = 0; c < cols_H; c++)
+                (*T)[b][c] += L->G[i][b] * (*H)[i][c];
+        }
+    }
+
+    /* (W * H)_i = G_i * T - s_i * H_i */
+    for (i = 0; i < L->N; i++)
+    {
+        for (c = 0; c < cols_H; c++)
+        {
+            (*result)[i][c] = 0;
+            for (b = 0; b < L->rank; b++)
+                (*result)[i][c] += L->G[i][b] * (*T)[b][c];
+            (*result)[i][c] -= L->s[i] * (*H)[i][c];
+        }
+    }
+    return 0;
+}
+
+/*
+ * Returns the mean entry of the low-rank W, used to scale the initial H.
+ */
+double lowrank_mean(lowrank_graph *L)
+{
+    double total = 0, *colsum;
+    int i, b;
+
+    colsum = (double *)calloc(L->rank > 0 ? L->rank : 1, sizeof(double));
+    if (colsum == NULL)
+        return 0;
+    for (i = 0; i < L->N; i++)
+    {
+        for (b = 0; b < L->rank; b++)
+            colsum[b] += L->G[i][b];
+        total -= L->s[i];
+    }
+    for (b = 0; b < L->rank; b++)
+        total += colsum[b] * colsum[b];
+    free(colsum);
+    return total / ((double)L->N * L->N);
+}
+
+/*
+ * Calculate the optimal 'H_out' matrix from the initial 'H_in' for the low-rank W '*L'.
+ * Each iteration costs O(N * (rank + k) * k). Approximation error can make (W * H)_ij negative,
+ * so the multiplicative factor is clamped at 0 to keep H nonnegative.
+ * pre: '*H_out' is NOT dynamically allocated.
+ * Returns 0 on success.
+ *
+ * 'H_out', 'H_in' - Address of a 2D array with dimensions 'rows_H' x 'cols_H'.
+ */
+int C_symnmf_lowrank(double ***H_out, double ***H_in, const int rows_H, const int cols_H, lowrank_graph *L)
+{
+    const symnmf_kernels *kernels = select_kernels(cols_H);
+    double **NUM, **T, *HtH, den, factor, diff, delta;
+    int iter, i, l, c, rows_T = L->rank > 0 ? L->rank : 1;
+
+    if (rows_H != L->N)
+        return 1;
+    HtH = (double *)malloc((size_t)cols_H * cols_H * sizeof(double));
+    if (HtH == NULL)
+        return 1;
+    if (allocate_2D_array(H_out, rows_H, cols_H) != 0)
+    {
+        free(HtH);
+        return 1;
+    }
+    /* W * H and G^T * H, one buffer each reused by every iteration */
+    if (allocate_2D_array(&NUM, rows_H, cols_H) != 0)
+    {
+        free(HtH);
+        free_2D_array(H_out, rows_H);
+        return 1;
+    }
+    if (allocate_2D_array(&T, rows_T, cols_H) != 0)
+    {
+        free_2D_array(&NUM, rows_H);
+        free(HtH);
+        free_2D_array(H_out, rows_H);
+        return 1;
+    }
+
+    delta = EPS + 1;
+    for (iter = 0; iter < MAX_ITER && delta >= EPS; iter++)
+    {
+        lowrank_mul(&NUM, &T, L, H_in, cols_H);
+        kernels->gram(HtH, *H_in, rows_H, cols_H);
+
+        delta = 0;
+        for (i = 0; i < rows_H; i++)
+        {
+            for (c = 0; c < cols_H; c++)
+            {
+                den = 0;
+                for (l = 0; l < cols_H; l++)
+                    den += (*H_in)[i][l] * HtH[l * cols_H + c];
+                if (den == 0)
+                {
+                    /* Division by zero */
+                    free_2D_array(&T, rows_T);
+                    free_2D_array(&NUM, rows_H);
+                    free(HtH);
+                    free_2D_array(H_out, rows_H);
+                    return 1;
+                }
+                factor = 1 - BETA + BETA * (NUM[i][c] / den);
+                (*H_out)[i][c] = (*H_in)[i][c] * (factor > 0 ? factor : 0);
+                diff = (*H_out)[i][c] - (*H_in)[i][c];
+                delta += diff * diff;
+            }
+        }
+        copy_matrix(H_in, H_out, rows_H, cols_H);
+    }
+
+    free_2D_array(&T, rows_T);
+    free_2D_array(&NUM, rows_H);
+    free(HtH);
+    return 0;
+}
+
+/*
+ * Free the dynamic memory of '*L'.
+ */
+void free_lowrank(lowrank_graph *L)
+{
+    if (L->G != NULL)
+        free_2D_array(&L->G, L->N);
+    free(L->s);
+    L->G = NULL;
+    L->s = NULL;
+}
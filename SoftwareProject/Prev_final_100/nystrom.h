@@ -0,0 +1,29 @@
+#ifndef NYSTROM_H
+#define NYSTROM_H
+
+/* Eigenvalues of the landmark affinity below NYSTROM_RCOND * max eigenvalue are dropped */
+#define NYSTROM_RCOND 1e-10
+
+/*
+ * Low-rank normalized similarity matrix W ~= G * G^T - diag(s).
+ * 'G' has dimensions 'N' x 'rank', 's' (length 'N') removes the diagonal, as a_ii == 0 in the exact W.
+ */
+typedef struct lowrank_graph
+{
+    int N, rank;
+    double **G;
+    double *s;
+} lowrank_graph;
+
+int C_nystrom_norm(lowrank_graph *L, double ***X, const int rows_X, const int cols_X,
+                   const int m, const unsigned long seed);
+
+int lowrank_mul(double ***result, double ***T, lowrank_graph *L, double ***H, const int cols_H);
+
+double lowrank_mean(lowrank_graph *L);
+
+int C_symnmf_lowrank(double ***H_out, double ***H_in, const int rows_H, const int cols_H, lowrank_graph *L);
+
+void free_lowrank(lowrank_graph *L);
+
+#endif
@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "symnmf.h"
+#include "placement.h"
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/* mbind modes, from <linux/mempolicy.h> */
+#define MPOL_PREFERRED 1
+#define MPOL_INTERLEAVE 3
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define NODE_ONLINE "/sys/devices/system/node/online"
+#define NODE_CPULIST "/sys/devices/system/node/node%d/cpulist"
+
+/*
+ * Placement of the large N x N matrices (A and W) on NUMA machines.
+ * A large matrix is one contiguous mapping, backed by huge pages when the system has them, so a row sweep of
+ * W * H walks far fewer TLB entries. Its pages get a node policy with mbind before anything touches them, so
+ * the placement holds no matter which thread first writes a row. Partitions are only preferred, not bound: a
+ * node that runs out of memory spills to the others instead of failing the allocation. The row pointers still make it a 2D array,
+ * free_2D_array recognizes it through the registry below.
+ */
+
+typedef struct placed_matrix
+{
+    double **rows;
+    void *map;
+    size_t map_len;
+    struct placed_matrix *next;
+} placed_matrix;
+
+static placed_matrix *placed = NULL;
+static placement_report last = {PLACE_OFF, PAGES_SMALL, 1, 0};
+static int node_ids[PLACEMENT_MAX_NODES];
+static int n_nodes = -1;
+
+/*
+ * Reads the online nodes once, "0-1,3" style, into 'node_ids'. A machine without the file has one node.
+ */
+static int online_nodes(void)
+{
+    FILE *file;
+    int lo, hi, c;
+
+    if (n_nodes >= 0)
+        return n_nodes;
+    n_nodes = 0;
+    file = fopen(NODE_ONLINE, "r");
+    while (file != NULL && fscanf(file, "%d", &lo) == 1)
+    {
+        hi = lo;
+        c = fgetc(file);
+        if (c == '-' && fscanf(file, "%d", &hi) == 1)
+            c = fgetc(file);
+        for (; lo <= hi && n_nodes < PLACEMENT_MAX_NODES; lo++)
+            node_ids[n_nodes++] = lo;
+        if (c != ',')
+            break;
+    }
+    if (file != NULL)
+        fclose(file);
+    if (n_nodes == 0)
+    {
+        node_ids[0] = 0;
+        n_nodes = 1;
+    }
+    return n_nodes;
+}
+
+/*
+ * Returns the policy forced by PLACEMENT_ENV, else partition on multi-node machines and local otherwise.
+ */
+static placement_policy requested_policy(void)
+{
+    const char *names[] = {"off", "local", "interleave", "partition"};
+    char *forced = getenv(PLACEMENT_ENV);
+    int p;
+
+    if (forced != NULL)
+    {
+        for (p = PLACE_OFF; p <= PLACE_PARTITION; p++)
+        {
+            if (strcmp(forced, names[p]) == 0)
+                return (placement_policy)p;
+        }
+    }
+    return online_nodes() > 1 ? PLACE_PARTITION : PLACE_LOCAL;
+}
+
+/*
+ * Binds ['addr', 'addr' + 'len') to the nodes of 'mask' with 'mode'.
+ * Returns 0 on success, 1 if the kernel has no mbind or refused it.
+ */
+static int bind_range(void *addr, const size_t len, const int mode, const unsigned long mask)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    if (len == 0)
+        return 0;
+    return syscall(SYS_mbind, addr, (unsigned long)len, mode, &mask, 8 * sizeof(mask) + 1, 0UL) != 0;
+#else
+    (void)addr;
+    (void)len;
+    (void)mode;
+    (void)mask;
+    return 1;
+#endif
+}
+
+/*
+ * Applies 'policy' to the mapping of 'rows' rows of 'row_bytes' bytes.
+ * Returns the policy that was applied.
+ */
+static placement_policy bind_matrix(char *map, const size_t map_len, const int rows, const size_t row_bytes,
+                                    const placement_policy policy)
+{
+    unsigned long all = 0;
+    size_t lo, hi;
+    int n, nodes = online_nodes();
+
+    if (nodes == 1 || policy == PLACE_LOCAL || node_ids[nodes - 1] >= (int)(8 * sizeof(all)))
+        return PLACE_LOCAL;
+
+    if (policy == PLACE_INTERLEAVE)
+    {
+        for (n = 0; n < nodes; n++)
+            all |= 1UL << node_ids[n];
+        return bind_range(map, map_len, MPOL_INTERLEAVE, all) == 0 ? PLACE_INTERLEAVE : PLACE_LOCAL;
+    }
+
+    /* Node boundaries at whole huge pages, the rows around a boundary may sit on either side */
+    for (n = 0; n < nodes; n++)
+    {
+        lo = (size_t)((long)n * rows / nodes) * row_bytes / PLACEMENT_HUGE_PAGE * PLACEMENT_HUGE_PAGE;
+        hi = n == nodes - 1 ? map_len
+                            : (size_t)((long)(n + 1) * rows / nodes) * row_bytes / PLACEMENT_HUGE_PAGE *
+                                  PLACEMENT_HUGE_PAGE;
+        if (bind_range(map + lo, hi - lo, MPOL_PREFERRED, 1UL << node_ids[n]) != 0)
+            return PLACE_LOCAL;
+    }
+    return PLACE_PARTITION;
+}
+
+/*
+ * Maps 'len' bytes aligned to PLACEMENT_HUGE_PAGE, from the hugetlb pool if possible, and sets '*pages'.
+ * Returns the mapping or NULL.
+ */
+static void *map_huge(const size_t len, placement_pages *pages)
+{
+    char *map, *aligned;
+    size_t head;
+
+#ifdef MAP_HUGETLB
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (map != MAP_FAILED)
+    {
+        *pages = PAGES_HUGETLB;
+        return map;
+    }
+#endif
+
+    /* Over-map by one huge page and trim, transparent huge pages need an aligned range */
+    map = mmap(NULL, len + PLACEMENT_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    aligned = (char *)(((unsigned long)map + PLACEMENT_HUGE_PAGE - 1) / PLACEMENT_HUGE_PAGE * PLACEMENT_HUGE_PAGE);
+    head = aligned - map;
+    if (head > 0)
+        munmap(map, head);
+    munmap(aligned + len, PLACEMENT_HUGE_PAGE - head);
+
+    *pages = PAGES_SMALL;
+#ifdef MADV_HUGEPAGE
+    if (madvise(aligned, len, MADV_HUGEPAGE) == 0)
+        *pages = PAGES_THP;
+#endif
+    return aligned;
+}
+
+/*
+ * Allocate a zeroed 'rows' x 'cols' matrix on '*M'. Matrices of at least PLACEMENT_MIN_BYTES are one
+ * huge page backed mapping placed by the policy of PLACEMENT_ENV, smaller ones come from allocate_2D_array.
+ * Either way '*M' is freed with free_2D_array.
+ * pre: '*M' is NOT dynamically allocated.
+ * Returns 0 on success.
+ */
+int allocate_matrix(double ***M, const int rows, const int cols)
+{
+    size_t row_bytes = (size_t)cols * sizeof(double), len;
+    placement_policy policy = requested_policy();
+    placement_pages pages;
+    placed_matrix *entry;
+    char *map;
+    int i;
+
+    if (policy == PLACE_OFF || (size_t)rows * row_bytes < PLACEMENT_MIN_BYTES)
+        return allocate_2D_array(M, rows, cols);
+
+    len = ((size_t)rows * row_bytes + PLACEMENT_HUGE_PAGE - 1) / PLACEMENT_HUGE_PAGE * PLACEMENT_HUGE_PAGE;
+    entry = (placed_matrix *)malloc(sizeof(placed_matrix));
+    *M = (double **)malloc(rows * sizeof(double *));
+    map = *M == NULL || entry == NULL ? NULL : (char *)map_huge(len, &pages);
+    if (map == NULL)
+    {
+        free(entry);
+        free(*M);
+        last.policy = PLACE_OFF;
+        last.pages = PAGES_SMALL;
+        last.bytes = (size_t)rows * row_bytes;
+        return allocate_2D_array(M, rows, cols);
+    }
+
+    last.policy = bind_matrix(map, len, rows, row_bytes, policy);
+    last.pages = pages;
+    last.nodes = online_nodes();
+    last.bytes = len;
+
+    for (i = 0; i < rows; i++)
+        (*M)[i] = (double *)(map + i * row_bytes);
+    entry->rows = *M;
+    entry->map = map;
+    entry->map_len = len;
+    entry->next = placed;
+    placed = entry;
+    return 0;
+}
+
+/*
+ * Unmap '*M' if allocate_matrix placed it.
+ * Returns 0 if '*M' was placed and is freed, 1 if it is an ordinary 2D array.
+ */
+int release_matrix(double ***M)
+{
+    placed_matrix **link, *entry;
+
+    for (link = &placed; *link != NULL; link = &(*link)->next)
+    {
+        if ((*link)->rows == *M)
+        {
+            entry = *link;
+            *link = entry->next;
+            munmap(entry->map, entry->map_len);
+            free(entry->rows);
+            free(entry);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Under the partition policy, runs the calling process on the CPUs of the node that holds row 'lo' of the
+ * 'rows' rows, so a worker reads its panel of W from local memory.
+ * Returns 0 on success, also when there is nothing to bind or the system has no CPU affinity (not Linux).
+ */
+int placement_bind_rows(const int lo, const int rows)
+{
+#ifdef __linux__
+    char path[64];
+    FILE *file;
+    cpu_set_t set;
+    int node, cpu_lo, cpu_hi, c, nodes = online_nodes();
+
+    if (nodes == 1 || requested_policy() != PLACE_PARTITION)
+        return 0;
+    node = node_ids[(int)((long)lo * nodes / rows)];
+    sprintf(path, NODE_CPULIST, node);
+    file = fopen(path, "r");
+    if (file == NULL)
+        return 1;
+
+    CPU_ZERO(&set);
+    while (fscanf(file, "%d", &cpu_lo) == 1)
+    {
+        cpu_hi = cpu_lo;
+        c = fgetc(file);
+        if (c == '-' && fscanf(file, "%d", &cpu_hi) == 1)
+            c = fgetc(file);
+        for (; cpu_lo <= cpu_hi && cpu_lo < CPU_SETSIZE; cpu_lo++)
+            CPU_SET(cpu_lo, &set);
+        if (c != ',')
+            break;
+    }
+    fclose(file);
+    return sched_setaffinity(0, sizeof(set), &set) != 0;
+#else
+    (void)lo;
+    (void)rows;
+    return 0;
+#endif
+}
+
+/*
+ * Returns how the last large matrix was placed.
+ */
+const placement_report *placement_last(void)
+{
+    return &last;
+}
+
+/*
+ * Returns the last placement in words, e.g. "partition nodes=2 pages=thp bytes=33554432".
+ */
+const char *placement_describe(void)
+{
+    static const char *policies[] = {"off", "local", "interleave", "partition"};
+    static const char *kinds[] = {"small", "thp", "hugetlb"};
+    static char text[128];
+
+    sprintf(text, "%s nodes=%d pages=%s bytes=%lu", policies[last.policy], last.nodes, kinds[last.pages],
+            (unsigned long)last.bytes);
+    return text;
+}
@@ -0,0 +1,61 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stddef.h>
+
+/* Forces a NUMA placement for the large matrices: "off", "local", "interleave" or "partition" */
+#define PLACEMENT_ENV "SYMNMF_PLACEMENT"
+
+/* Matrices smaller than PLACEMENT_MIN_BYTES keep the per-row allocation of allocate_2D_array */
+#define PLACEMENT_MIN_BYTES (2UL * 1024UL * 1024UL)
+
+/* Huge page size, also the granularity at which the row ranges of the nodes are split */
+#define PLACEMENT_HUGE_PAGE (2UL * 1024UL * 1024UL)
+
+/* Nodes beyond the first PLACEMENT_MAX_NODES are ignored */
+#define PLACEMENT_MAX_NODES 64
+
+typedef enum placement_policy
+{
+    /* allocate_2D_array, one calloc per row */
+    PLACE_OFF = 0,
+    /* One mapping, pages land on the node of the thread that first touches them */
+    PLACE_LOCAL = 1,
+    /* One mapping, pages spread round robin over all nodes */
+    PLACE_INTERLEAVE = 2,
+    /* One mapping, node n holds the rows [n * rows / nodes, (n + 1) * rows / nodes), like the dist workers */
+    PLACE_PARTITION = 3
+} placement_policy;
+
+typedef enum placement_pages
+{
+    PAGES_SMALL = 0,
+    /* Transparent huge pages requested with madvise */
+    PAGES_THP = 1,
+    /* Explicit huge pages from the hugetlb pool */
+    PAGES_HUGETLB = 2
+} placement_pages;
+
+/*
+ * How the last large matrix was placed. 'policy' is the one actually applied, which is PLACE_LOCAL when
+ * the kernel refused the requested one.
+ */
+typedef struct placement_report
+{
+    placement_policy policy;
+    placement_pages pages;
+    int nodes;
+    size_t bytes;
+} placement_report;
+
+int allocate_matrix(double ***M, const int rows, const int cols);
+
+int release_matrix(double ***M);
+
+int placement_bind_rows(const int lo, const int rows);
+
+const placement_report *placement_last(void);
+
+const char *placement_describe(void);
+
+#endif
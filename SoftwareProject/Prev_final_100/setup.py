@@ -1,6 +1,8 @@
 from setuptools import Extension, setup
 
-module = Extension("symnmfmodule", sources=['symnmfmodule.c', 'symnmf.c'])
+module = Extension("symnmfmodule", sources=['symnmfmodule.c', 'symnmf.c', 'cache.c', 'kernels.c', 'isa.c',
+                                         'dist.c', 'transport_shm.c', 'nystrom.c', 'knn.c', 'stream.c',
+                                         'init.c', 'placement.c', 'ingest.c', 'tune.c', 'dedup.c'])
 setup(name='symnmfmodule',
       version='1.0',
       description='Python wrapper for custom C extension',
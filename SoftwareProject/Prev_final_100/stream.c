@@ -0,0 +1,183 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symnmf.h"
+#include "stream.h"
+#include "isa.h"
+#include "tune.h"
+
+/*
+ * Streaming versions of the CLI goals: the similarity matrix is regenerated one block of rows at a time
+ * and printed right away, so memory stays O(N * d + block) instead of the N x N matrices of C_sym and C_norm.
+ * Every entry is computed with the same kernels and in the same order as C_sym, C_ddg and C_norm,
+ * so the output is identical.
+ */
+
+/* Returns the number of rows of N entries that fit in the tuned stream_block_bytes, at least 1 */
+static int block_rows(const int N)
+{
+    int rows = (int)(tuning_current()->stream_block_bytes / ((size_t)N * sizeof(double)));
+    return rows < 1 ? 1 : rows;
+}
+
+/*
+ * Calculate the rows ['lo', 'hi') of the similarity matrix into 'block'.
+ * Every X[j] is read once for the whole block.
+ *
+ * 'block' - 2D array with dimensions at least ('hi' - 'lo') x 'rows_X'.
+ */
+static void sym_rows(double **block, double ***X, const int rows_X, const int cols_X, const int lo, const int hi,
+                     const isa_kernels *isa)
+{
+    int i, j;
+    for (j = 0; j < rows_X; j++)
+    {
+        for (i = lo; i < hi; i++)
+            block[i - lo][j] = i == j ? 0 : exp(-SYM_KERNEL_SCALE * isa->dist2((*X)[i], (*X)[j], cols_X));
+    }
+}
+
+/*
+ * First pass of ddg and norm: calculate the degrees '*D' without keeping the similarity rows,
+ * or copy them from 'degrees' when the caller already has them.
+ * pre: '*D' is NOT dynamically allocated.
+ * Returns 0 on success.
+ */
+int stream_degrees(double **D, double ***X, const int rows_X, const int cols_X, const double *degrees)
+{
+    const isa_kernels *isa = isa_select();
+    double **block;
+    int lo, hi, i, B = block_rows(rows_X);
+
+    *D = (double *)malloc(rows_X * sizeof(double));
+    if (*D == NULL)
+        return 1;
+    if (degrees != NULL)
+    {
+        memcpy(*D, degrees, rows_X * sizeof(double));
+        return 0;
+    }
+    if (allocate_2D_array(&block, B, rows_X) != 0)
+    {
+        free(*D);
+        return 1;
+    }
+
+    for (lo = 0; lo < rows_X; lo += B)
+    {
+        hi = lo + B < rows_X ? lo + B : rows_X;
+        sym_rows(block, X, rows_X, cols_X, lo, hi, isa);
+        for (i = lo; i < hi; i++)
+            (*D)[i] = isa->row_sum(block[i - lo], rows_X);
+    }
+
+    free_2D_array(&block, B);
+    return 0;
+}
+
+/*
+ * Print the similarity matrix of X row by row.
+ * Returns 0 on success.
+ *
+ * 'X' - Address of 2D matrix that contains 'rows_X' vectors, each having a size of 'cols_X'.
+ */
+int stream_sym(double ***X, const int rows_X, const int cols_X)
+{
+    const isa_kernels *isa = isa_select();
+    double **block;
+    int lo, hi, i, B = block_rows(rows_X);
+
+    if (allocate_2D_array(&block, B, rows_X) != 0)
+        return 1;
+
+    for (lo = 0; lo < rows_X; lo += B)
+    {
+        hi = lo + B < rows_X ? lo + B : rows_X;
+        sym_rows(block, X, rows_X, cols_X, lo, hi, isa);
+        for (i = lo; i < hi; i++)
+            print_row(block[i - lo], rows_X);
+    }
+
+    free_2D_array(&block, B);
+    return 0;
+}
+
+/*
+ * Print the diagonal degree matrix of X row by row.
+ * Returns 0 on success.
+ *
+ * 'X' - Address of 2D matrix that contains 'rows_X' vectors, each having a size of 'cols_X'.
+ * 'degrees' - The degrees of X if already known (see ingest_file), NULL to calculate them.
+ */
+int stream_ddg(double ***X, const int rows_X, const int cols_X, const double *degrees)
+{
+    double *D, *row;
+    int i;
+
+    if (stream_degrees(&D, X, rows_X, cols_X, degrees) != 0)
+        return 1;
+    row = (double *)calloc(rows_X, sizeof(double));
+    if (row == NULL)
+    {
+        free(D);
+        return 1;
+    }
+
+    for (i = 0; i < rows_X; i++)
+    {
+        row[i] = D[i];
+        print_row(row, rows_X);
+        row[i] = 0;
+    }
+
+    free(row);
+    free(D);
+    return 0;
+}
+
+/*
+ * Print the normalized similarity matrix of X row by row.
+ * The degrees take one pass over the similarity rows, a second pass regenerates and scales them.
+ * Returns 0 on success.
+ *
+ * 'X' - Address of 2D matrix that contains 'rows_X' vectors, each having a size of 'cols_X'.
+ * 'degrees' - The degrees of X if already known (see ingest_file), NULL to calculate them.
+ */
+int stream_norm(double ***X, const int rows_X, const int cols_X, const double *degrees)
+{
+    const isa_kernels *isa = isa_select();
+    double *D, *P, *row, **block;
+    int lo, hi, i, B = block_rows(rows_X);
+
+    if (stream_degrees(&D, X, rows_X, cols_X, degrees) != 0)
+        return 1;
+    /* Let P = D^(-1/2), as in C_norm w_ij = (a_ij * p_j) * p_i */
+    P = (double *)malloc(rows_X * sizeof(double));
+    row = (double *)malloc(rows_X * sizeof(double));
+    if (P == NULL || row == NULL || allocate_2D_array(&block, B, rows_X) != 0)
+    {
+        free(P);
+        free(row);
+        free(D);
+        return 1;
+    }
+    for (i = 0; i < rows_X; i++)
+        P[i] = pow(D[i], -0.5);
+    free(D);
+
+    for (lo = 0; lo < rows_X; lo += B)
+    {
+        hi = lo + B < rows_X ? lo + B : rows_X;
+        sym_rows(block, X, rows_X, cols_X, lo, hi, isa);
+        for (i = lo; i < hi; i++)
+        {
+            isa->scale_row(row, block[i - lo], P, P[i], rows_X);
+            print_row(row, rows_X);
+        }
+    }
+
+    free_2D_array(&block, B);
+    free(row);
+    free(P);
+    return 0;
+}
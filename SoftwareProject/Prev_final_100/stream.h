@@ -0,0 +1,15 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+/* Default bytes of similarity rows formed at once by the streaming goals, at least one row */
+#define STREAM_BLOCK_BYTES (1024 * 1024)
+
+int stream_degrees(double **D, double ***X, const int rows_X, const int cols_X, const double *degrees);
+
+int stream_sym(double ***X, const int rows_X, const int cols_X);
+
+int stream_ddg(double ***X, const int rows_X, const int cols_X, const double *degrees);
+
+int stream_norm(double ***X, const int rows_X, const int cols_X, const double *degrees);
+
+#endif
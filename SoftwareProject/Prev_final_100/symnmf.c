@@ -1,16 +1,25 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include "symnmf.h"
+#include "cache.h"
+#include "kernels.h"
+#include "isa.h"
+#include "stream.h"
+#include "placement.h"
+#include "ingest.h"
+#include "tune.h"
+#include "dedup.h"
 
-#define BETA 0.5
-#define MAX_ITER 300
-#define EPS 0.0001
 #define DELIMITER ','
 #define SYM "sym"
 #define DDG "ddg"
 #define NORM "norm"
+#define TUNE "tune"
 
 const char *ERR_MSG = "An Error Has Occurred\n";
 
@@ -48,6 +57,8 @@ int allocate_2D_array(double ***arr, int rows, int cols)
 int free_2D_array(double ***arr, int rows)
 {
     int i;
+    if (release_matrix(arr) == 0)
+        return 0;
     for (i = 0; i < rows; i++)
         free((*arr)[i]);
     free((*arr));
@@ -67,18 +78,27 @@ int free_2D_array(double ***arr, int rows)
  */
 int print_matrix(double ***M, const int rows, const int cols)
 {
-    int i, j;
+    int i;
     for (i = 0; i < rows; i++)
+        print_row((*M)[i], cols);
+    return 0;
+}
+
+/*
+ * Print one matrix row of 'cols' entries in the format of print_matrix.
+ * Returns 0 on success.
+ */
+int print_row(const double *row, const int cols)
+{
+    int j;
+    for (j = 0; j < cols; j++)
     {
-        for (j = 0; j < cols; j++)
-        {
-            printf("%.4f", (*M)[i][j]);
+        printf("%.4f", row[j]);
 
-            if (j != cols - 1)
-                printf("%c", DELIMITER);
-        }
-        printf("\n");
+        if (j != cols - 1)
+            printf("%c", DELIMITER);
     }
+    printf("\n");
     return 0;
 }
 
@@ -207,85 +227,107 @@ int pow_diag_matrix(double **result, double **D, const int N, const double power
 }
 
 /*
- * Calculate (A,B) matrix inner product and place it in '*result'.
- * pre: '*result' is NOT dynamically allocated.
- * Returns 0 on success.
+ * Returns the squared frobenius norm of the matrix '*M'.
  *
- * C == (A,B) iff for every i,j in [0,N): c_ij == Σ a_i0*b_kj + a_i0*b_kj
+ * F_norm_squared(A) == ΣΣ |a_ij|^2
  *
- * 'A' - Address of 2D array with dimensions 'rows_A' x 'cols_A'.
- * 'B' - Address of 2D array with dimensions 'rows_B' x 'cols_B'.
+ * 'M' - Address of 2D array with dimensions 'rows' x 'cols'.
  */
-int mul_matrix(double ***result, double ***A, const int rows_A, const int cols_A,
-               double ***B, const int rows_B, const int cols_B)
+double F_norm_squared(double ***M, const int rows, const int cols)
 {
-    int i, j, k, N;
-    if (cols_A != rows_B)
-        return 1;
-    N = cols_A;
-
-    if (allocate_2D_array(result, rows_A, cols_B) != 0)
-        return 1;
-
-    for (i = 0; i < rows_A; i++)
+    int i, j;
+    double norm_squared;
+    norm_squared = 0;
+    for (i = 0; i < rows; i++)
     {
-        for (j = 0; j < cols_B; j++)
+        for (j = 0; j < cols; j++)
         {
-            for (k = 0; k < N; k++)
-            {
-                (*result)[i][j] += (*A)[i][k] * (*B)[k][j];
-            }
+            norm_squared += pow((*M)[i][j], 2);
         }
     }
-
-    return 0;
+    return norm_squared;
 }
 
 /*
- * Calculate the transposed matrix of '*M' and place it in '*result'.
- * pre: '*result' is NOT dynamically allocated.
+ * Calculate the eigen decomposition M == V * diag(lambda) * V^T of the symmetric matrix '*M'
+ * by cyclic Jacobi rotations, and place the eigenvectors (as columns) in '*V' and the eigenvalues in '*lambda'.
+ * pre: '*V' and '*lambda' are NOT dynamically allocated. '*M' is overwritten.
  * Returns 0 on success.
  *
- * T == M_T iff for every i,j in [0,N): t_ij == m_ji
- *
- * 'M' - Address of 2D array with dimensions 'rows' x 'cols'.
+ * 'M' - Address of a symmetric 2D array with dimensions 'N' x 'N'.
  */
-int transpose(double ***result, double ***M, const int rows, const int cols)
+int jacobi_eigen(double ***V, double **lambda, double ***M, const int N)
 {
-    int i, j;
-    if (allocate_2D_array(result, cols, rows) != 0)
+    int sweep, p, q, i;
+    double off, total, theta, t, c, s, a, b;
+
+    if (allocate_2D_array(V, N, N) != 0)
+        return 1;
+    *lambda = (double *)malloc(N * sizeof(double));
+    if (*lambda == NULL)
+    {
+        free_2D_array(V, N);
         return 1;
+    }
+    for (i = 0; i < N; i++)
+        (*V)[i][i] = 1;
 
-    for (i = 0; i < cols; i++)
+    for (sweep = 0; sweep < JACOBI_MAX_SWEEPS; sweep++)
     {
-        for (j = 0; j < rows; j++)
+        off = 0;
+        total = 0;
+        for (p = 0; p < N; p++)
         {
-            (*result)[i][j] = (*M)[j][i];
+            total += (*M)[p][p] * (*M)[p][p];
+            for (q = p + 1; q < N; q++)
+                off += (*M)[p][q] * (*M)[p][q];
         }
-    }
-    return 0;
-}
+        if (off <= JACOBI_EPS * (total + off))
+            break;
 
-/*
- * Returns the squared frobenius norm of the matrix '*M'.
- *
- * F_norm_squared(A) == ΣΣ |a_ij|^2
- *
- * 'M' - Address of 2D array with dimensions 'rows' x 'cols'.
- */
-double F_norm_squared(double ***M, const int rows, const int cols)
-{
-    int i, j;
-    double norm_squared;
-    norm_squared = 0;
-    for (i = 0; i < rows; i++)
-    {
-        for (j = 0; j < cols; j++)
+        for (p = 0; p < N; p++)
         {
-            norm_squared += pow((*M)[i][j], 2);
+            for (q = p + 1; q < N; q++)
+            {
+                if ((*M)[p][q] == 0)
+                    continue;
+
+                /* Rotation that zeroes m_pq */
+                theta = ((*M)[q][q] - (*M)[p][p]) / (2 * (*M)[p][q]);
+                t = 1 / (fabs(theta) + sqrt(theta * theta + 1));
+                if (theta < 0)
+                    t = -t;
+                c = 1 / sqrt(t * t + 1);
+                s = t * c;
+
+                for (i = 0; i < N; i++)
+                {
+                    a = (*M)[i][p];
+                    b = (*M)[i][q];
+                    (*M)[i][p] = c * a - s * b;
+                    (*M)[i][q] = s * a + c * b;
+                }
+                for (i = 0; i < N; i++)
+                {
+                    a = (*M)[p][i];
+                    b = (*M)[q][i];
+                    (*M)[p][i] = c * a - s * b;
+                    (*M)[q][i] = s * a + c * b;
+                }
+                for (i = 0; i < N; i++)
+                {
+                    a = (*V)[i][p];
+                    b = (*V)[i][q];
+                    (*V)[i][p] = c * a - s * b;
+                    (*V)[i][q] = s * a + c * b;
+                }
+            }
         }
     }
-    return norm_squared;
+
+    for (i = 0; i < N; i++)
+        (*lambda)[i] = (*M)[i][i];
+    return 0;
 }
 
 /*
@@ -315,31 +357,36 @@ int parse_diag_to_matrix_form(double ***M, double **D, const int N)
  */
 int C_sym(double ***A, double ***X, const int rows_X, const int cols_X)
 {
-    double a_ij, *temp_sub;
-    int i, j, N, d;
+    const isa_kernels *isa = isa_select();
+    double a_ij;
+    int i, j, N, d, T, ti, tj, i_end, j_end;
 
     N = rows_X;
     d = cols_X;
+    T = tuning_current()->sym_tile > 0 ? tuning_current()->sym_tile : N;
 
-    if (allocate_2D_array(A, N, N) != 0)
+    if (allocate_matrix(A, N, N) != 0)
         return 1;
 
-    temp_sub = (double *)malloc(d * sizeof(double));
-    if (temp_sub == NULL)
-        return 1;
-
-    for (i = 0; i < N; i++)
+    /* Tiles of T x T pairs keep both blocks of X rows in cache; T = N is the plain upper triangle walk */
+    for (ti = 0; ti < N; ti += T)
     {
-        for (j = i + 1; j < N; j++)
+        i_end = ti + T < N ? ti + T : N;
+        for (tj = ti; tj < N; tj += T)
         {
-            vector_sub(&temp_sub, &((*X)[i]), &((*X)[j]), d);
-            a_ij = exp(-0.5 * norm2_squared(&temp_sub, d));
+            j_end = tj + T < N ? tj + T : N;
+            for (i = ti; i < i_end; i++)
+            {
+                for (j = tj > i + 1 ? tj : i + 1; j < j_end; j++)
+                {
+                    a_ij = exp(-SYM_KERNEL_SCALE * isa->dist2((*X)[i], (*X)[j], d));
 
-            (*A)[i][j] = a_ij;
-            (*A)[j][i] = a_ij;
+                    (*A)[i][j] = a_ij;
+                    (*A)[j][i] = a_ij;
+                }
+            }
         }
     }
-    free(temp_sub);
 
     return 0;
 }
@@ -354,16 +401,14 @@ int C_sym(double ***A, double ***X, const int rows_X, const int cols_X)
 int C_ddg(double **D, double ***A, const int N)
 {
     /* D is an address of 1D array that represents a diagonal matrix */
-    int i, j;
+    const isa_kernels *isa = isa_select();
+    int i;
     (*D) = (double *)calloc(N, sizeof(double));
     if (*D == NULL)
         return 1;
 
     for (i = 0; i < N; i++)
-    {
-        for (j = 0; j < N; j++)
-            (*D)[i] += (*A)[i][j];
-    }
+        (*D)[i] = isa->row_sum((*A)[i], N);
     return 0;
 }
 
@@ -378,18 +423,24 @@ int C_ddg(double **D, double ***A, const int N)
 
 int C_norm(double ***W, double **D, double ***A, const int N)
 {
-    /* Let P = D^(-1/2) */
-    double *P, **temp_calc;
-    pow_diag_matrix(&P, D, N, -0.5);
+    /* Let P = D^(-1/2), W = P * A * P is formed in one pass: w_ij = (a_ij * p_j) * p_i */
+    const isa_kernels *isa = isa_select();
+    double *P;
+    int i;
 
-    if (mul_diag_matrix(&temp_calc, A, &P, N, 1) != 0)
+    if (pow_diag_matrix(&P, D, N, -0.5) != 0)
         return 1;
 
-    if (mul_diag_matrix(W, &temp_calc, &P, N, 0) != 0)
+    if (allocate_matrix(W, N, N) != 0)
+    {
+        free(P);
         return 1;
+    }
+
+    for (i = 0; i < N; i++)
+        isa->scale_row((*W)[i], (*A)[i], P, P[i], N);
 
     free(P);
-    free_2D_array(&temp_calc, N);
     return 0;
 }
 
@@ -404,114 +455,287 @@ int C_norm(double ***W, double **D, double ***A, const int N)
 int update_H(double ***H_out, double ***H_in, const int rows_H, const int cols_H,
              double ***W, const int N_W)
 {
+    const symnmf_kernels *kernels;
+    double *HtH;
+    int failed;
 
-    double **NUM, **DEN_temp, **DEN, **H_T;
-    int i, j;
-
-    if (transpose(&H_T, H_in, rows_H, cols_H) != 0)
+    /* H * H^T * H == H * (H^T * H), so only the k x k Gram matrix is formed instead of the N x N H * H^T */
+    HtH = (double *)malloc(cols_H * cols_H * sizeof(double));
+    if (HtH == NULL)
         return 1;
 
     /* Note: rows_H == N_W */
-    /* NUM dim: N_W x cols_H == rows_H x cols_H */
-    if (mul_matrix(&NUM, W, N_W, N_W, H_in, rows_H, cols_H) != 0)
-    {
-        free_2D_array(&H_T, cols_H);
-        free_2D_array(&NUM, rows_H);
-        return 1;
-    }
+    kernels = select_kernels(cols_H);
+    kernels->gram(HtH, *H_in, rows_H, cols_H);
+    failed = kernels->update_rows(*H_out, *W, *H_in, N_W, HtH, 0, rows_H, cols_H, BETA, NULL);
 
-    /* DEN_temp dim: rows_H x rows_H */
-    if (mul_matrix(&DEN_temp, H_in, rows_H, cols_H, &H_T, cols_H, rows_H) != 0)
-    {
-        free_2D_array(&H_T, cols_H);
-        free_2D_array(&NUM, rows_H);
-        free_2D_array(&DEN_temp, rows_H);
-        return 1;
-    }
+    free(HtH);
+    return failed;
+}
 
-    /* DEN dim: rows_H x cols_H */
-    if (mul_matrix(&DEN, &DEN_temp, rows_H, rows_H, H_in, rows_H, cols_H) != 0)
+/*
+ * Calculate the optimal 'H_out' matrix from the initial 'H_in' based on the instructions.
+ * pre: '*H_out' is NOT dynamically allocated.
+ * Returns 0 on success.
+ *
+ * 'H_out', 'H_in' - Address of a 2D array with dimensions 'rows_H' x 'cols_H'.
+ * 'W' - Address of a 2D array with dimensions 'N_W' x 'N_W'.
+ */
+int C_symnmf(double ***H_out, double ***H_in, const int rows_H, const int cols_H,
+             double ***W, const int N_W)
+{
+    const stopping_rule rule = {MAX_ITER, EPS, 0, 0, 0};
+    return C_symnmf_tracked(H_out, H_in, rows_H, cols_H, W, N_W, &rule, NULL);
+}
+
+/*
+ * Returns the monotonic wall clock in seconds.
+ */
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Calculate the optimal 'H_out' matrix from the initial 'H_in' until one of the stopping rules '*rule' holds.
+ * The update kernel also sums the squared step and trace(H^T * W * H), and with the H^T * H it already forms,
+ * ||W - H * H^T||_F^2 == ||W||_F^2 - 2 * trace(H^T * W * H) + ||H^T * H||_F^2
+ * costs O(k^2) per iteration. Both sums are taken at 'H_in', so the objective is that of the previous iterate.
+ * Only ||W||_F^2 takes a pass over W, once, and only when the 'rel_objective' rule is on.
+ * pre: '*H_out' is NOT dynamically allocated.
+ * Returns 0 on success.
+ *
+ * 'H_out', 'H_in' - Address of a 2D array with dimensions 'rows_H' x 'cols_H'.
+ * 'W' - Address of a 2D array with dimensions 'N_W' x 'N_W'.
+ * 'report' - Receives the outcome of the run, may be NULL.
+ */
+int C_symnmf_tracked(double ***H_out, double ***H_in, const int rows_H, const int cols_H,
+                     double ***W, const int N_W, const stopping_rule *rule, symnmf_report *report)
+{
+    const symnmf_kernels *kernels = select_kernels(cols_H);
+    symnmf_report r = {0, -1, 0, STOP_MAX_ITER};
+    double *HtH, stats[2], W_norm = 0, gram_norm, previous = -1, start = now_seconds();
+    int l, stalled = 0, objective = rule->rel_objective > 0;
+
+    HtH = (double *)malloc(cols_H * cols_H * sizeof(double));
+    if (HtH == NULL)
+        return 1;
+    if (allocate_2D_array(H_out, rows_H, cols_H) != 0)
     {
-        free_2D_array(&H_T, cols_H);
-        free_2D_array(&NUM, rows_H);
-        free_2D_array(&DEN_temp, rows_H);
-        free_2D_array(&DEN, rows_H);
+        free(HtH);
         return 1;
     }
+    if (objective)
+        W_norm = F_norm_squared(W, N_W, N_W);
 
-    /* Calculate H_out */
-    /* H_out dim == DEN dim == NUM dim */
-    for (i = 0; i < rows_H; i++)
+    r.delta = rule->delta_eps + 1; /* Initial value */
+    while (r.iterations < rule->max_iter)
     {
-        for (j = 0; j < cols_H; j++)
+        /* Note: rows_H == N_W */
+        kernels->gram(HtH, *H_in, rows_H, cols_H);
+        stats[0] = 0;
+        stats[1] = 0;
+        if (kernels->update_rows(*H_out, *W, *H_in, N_W, HtH, 0, rows_H, cols_H, BETA, stats) != 0)
         {
+            /* Division by zero */
+            free(HtH);
+            free_2D_array(H_out, rows_H);
+            return 1;
+        }
+        copy_matrix(H_in, H_out, rows_H, cols_H);
+        r.iterations++;
 
-            if (DEN[i][j] == 0)
-            {
-                /* Division by zero */
-                free_2D_array(&H_T, cols_H);
-                free_2D_array(&NUM, rows_H);
-                free_2D_array(&DEN_temp, rows_H);
-                free_2D_array(&DEN, rows_H);
-                return 1;
-            }
-            (*H_out)[i][j] = (*H_in)[i][j] * (1 - BETA + BETA * (NUM[i][j] / DEN[i][j]));
+        /* Stalled: the step barely shrinks; a growing step means H is still moving off its start and resets */
+        stalled = r.iterations > 1 && stats[1] >= STALL_RATIO * r.delta && stats[1] <= r.delta ? stalled + 1 : 0;
+        r.delta = stats[1];
+        if (objective)
+        {
+            gram_norm = 0;
+            for (l = 0; l < cols_H * cols_H; l++)
+                gram_norm += HtH[l] * HtH[l];
+            previous = r.prev_objective;
+            r.prev_objective = W_norm - 2 * stats[0] + gram_norm;
         }
+
+        if (r.delta < rule->delta_eps)
+            r.reason = STOP_DELTA;
+        else if (rule->rel_objective > 0 && previous >= 0 &&
+                 fabs(previous - r.prev_objective) < rule->rel_objective * previous)
+            r.reason = STOP_OBJECTIVE;
+        else if (rule->stall_iters > 0 && stalled >= rule->stall_iters)
+            r.reason = STOP_STALL;
+        else if (rule->time_budget > 0 && now_seconds() - start >= rule->time_budget)
+            r.reason = STOP_TIME;
+        else
+            continue;
+        break;
     }
 
-    free_2D_array(&NUM, rows_H);
-    free_2D_array(&DEN_temp, rows_H);
-    free_2D_array(&DEN, rows_H);
-    free_2D_array(&H_T, cols_H);
+    if (report != NULL)
+        *report = r;
+    free(HtH);
+    return 0;
+}
+
+/*
+ * Advances the linear congruential generator '*state' and returns its next value.
+ */
+unsigned long lcg_next(unsigned long *state)
+{
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return *state >> 11;
+}
+
+/*
+ * Update the rows ['first', 'first' + 'count') of '*H' in place, using only the matching row panel of '*W'
+ * and the running Gram matrix 'HtH', which is kept equal to H^T * H.
+ * pre: '*block' is dynamically allocated with dimensions at least 'count' x 'cols_H'.
+ * Returns 0 on success, 1 on division by zero.
+ *
+ * 'H' - Address of a 2D array with dimensions 'rows_H' x 'cols_H'.
+ * 'HtH' - 1D array of length 'cols_H' x 'cols_H', H^T * H stored row after row.
+ * 'W' - Address of a 2D array with dimensions 'rows_H' x 'rows_H'.
+ * 'beta' - Step size of the multiplicative update.
+ */
+static int update_H_block(double ***H, double *HtH, double ***block, const int first, const int count,
+                          const int rows_H, const int cols_H, double ***W, const double beta)
+{
+    int r, i, l, c;
+
+    if (select_kernels(cols_H)->update_rows(*block, *W, *H, rows_H, HtH, first, first + count, cols_H, beta,
+                                            NULL) != 0)
+        return 1;
 
+    /* Write the block back and keep H^T * H up to date with a rank-'count' correction */
+    for (r = 0; r < count; r++)
+    {
+        i = first + r;
+        for (l = 0; l < cols_H; l++)
+        {
+            for (c = 0; c < cols_H; c++)
+                HtH[l * cols_H + c] += (*block)[r][l] * (*block)[r][c] - (*H)[i][l] * (*H)[i][c];
+        }
+        memcpy((*H)[i], (*block)[r], cols_H * sizeof(double));
+    }
     return 0;
 }
 
 /*
- * Calculate the optimal 'H_out' matrix from the initial 'H_in' based on the instructions.
+ * Calculate 'H_out' from the initial 'H_in' by stochastic row-block updates.
+ * Every step updates one random block of rows of H, so it reads only the matching row panel of 'W'.
+ * Every 'schedule->check_every' steps, the full residual ||H - H_checkpoint||^2 is compared to EPS,
+ * and the running H^T * H is recomputed to drop rounding drift.
  * pre: '*H_out' is NOT dynamically allocated.
  * Returns 0 on success.
  *
  * 'H_out', 'H_in' - Address of a 2D array with dimensions 'rows_H' x 'cols_H'.
  * 'W' - Address of a 2D array with dimensions 'N_W' x 'N_W'.
+ * 'schedule' - Block size, check period, step decay and seed. Zero fields select the defaults.
  */
-int C_symnmf(double ***H_out, double ***H_in, const int rows_H, const int cols_H,
-             double ***W, const int N_W)
+int C_symnmf_stochastic(double ***H_out, double ***H_in, const int rows_H, const int cols_H,
+                        double ***W, const int N_W, const stochastic_schedule *schedule)
 {
-    int i;
-    double F_norm_s_val;
-    double **SUB;
-
+    int block_rows, check_every, n_blocks, step, max_steps, b, t, swap, *order, failed;
+    unsigned long state;
+    double beta, residual, *HtH, **block, **SUB;
+
+    block_rows = schedule->block_rows;
+    if (block_rows <= 0)
+        block_rows = STOCHASTIC_PANEL_BYTES / (N_W * sizeof(double));
+    if (block_rows < 1)
+        block_rows = 1;
+    if (block_rows > rows_H)
+        block_rows = rows_H;
+
+    n_blocks = (rows_H + block_rows - 1) / block_rows;
+    check_every = schedule->check_every > 0 ? schedule->check_every : n_blocks;
+    max_steps = MAX_ITER * n_blocks;
+    state = schedule->seed;
+
+    order = (int *)malloc(n_blocks * sizeof(int));
+    if (order == NULL)
+        return 1;
+    HtH = (double *)malloc(cols_H * cols_H * sizeof(double));
+    if (HtH == NULL)
+    {
+        free(order);
+        return 1;
+    }
+    if (allocate_2D_array(&block, block_rows, cols_H) != 0)
+    {
+        free(order);
+        free(HtH);
+        return 1;
+    }
     if (allocate_2D_array(&SUB, rows_H, cols_H) != 0)
+    {
+        free(order);
+        free(HtH);
+        free_2D_array(&block, block_rows);
         return 1;
+    }
     if (allocate_2D_array(H_out, rows_H, cols_H) != 0)
     {
+        free(order);
+        free(HtH);
+        free_2D_array(&block, block_rows);
         free_2D_array(&SUB, rows_H);
         return 1;
     }
 
-    F_norm_s_val = EPS + 1; /* Initial value */
-    i = 0;
+    copy_matrix(H_out, H_in, rows_H, cols_H);
+    select_kernels(cols_H)->gram(HtH, *H_out, rows_H, cols_H);
+    for (b = 0; b < n_blocks; b++)
+        order[b] = b;
 
-    while (i < MAX_ITER && F_norm_s_val >= EPS)
+    failed = 0;
+    for (step = 0; step < max_steps; step++)
     {
+        if (step % n_blocks == 0)
+        {
+            /* New epoch: visit the blocks in a fresh random order */
+            for (b = n_blocks - 1; b > 0; b--)
+            {
+                t = (int)(lcg_next(&state) % (unsigned long)(b + 1));
+                swap = order[t];
+                order[t] = order[b];
+                order[b] = swap;
+            }
+        }
+        b = order[step % n_blocks];
+        beta = BETA / (1 + schedule->decay * (step / n_blocks));
 
-        if (update_H(H_out, H_in, rows_H, cols_H, W, N_W) != 0)
+        if (update_H_block(H_out, HtH, &block, b * block_rows,
+                           b == n_blocks - 1 ? rows_H - b * block_rows : block_rows,
+                           rows_H, cols_H, W, beta) != 0)
         {
             /* Division by zero */
-            free_2D_array(&SUB, N_W);
-            free_2D_array(H_out, N_W);
-
-            return 1;
+            failed = 1;
+            break;
         }
-        matrix_sub(&SUB, H_out, H_in, rows_H, cols_H);
-        F_norm_s_val = F_norm_squared(&SUB, rows_H, cols_H);
-        copy_matrix(H_in, H_out, rows_H, cols_H);
 
-        i++;
+        if ((step + 1) % check_every == 0)
+        {
+            matrix_sub(&SUB, H_out, H_in, rows_H, cols_H);
+            residual = F_norm_squared(&SUB, rows_H, cols_H);
+            copy_matrix(H_in, H_out, rows_H, cols_H);
+            if (residual < EPS)
+                break;
+            select_kernels(cols_H)->gram(HtH, *H_out, rows_H, cols_H);
+        }
     }
 
-    free_2D_array(&SUB, N_W);
+    free(order);
+    free(HtH);
+    free_2D_array(&block, block_rows);
+    free_2D_array(&SUB, rows_H);
+    if (failed)
+    {
+        free_2D_array(H_out, rows_H);
+        return 1;
+    }
     return 0;
 }
 
@@ -591,9 +815,10 @@ int read_file(double ***X, char **file_name, int *rows, int *cols)
     return 0;
 }
 
+#ifndef SYMNMF_NO_MAIN
 /* Main program
  * Print the requested matrix by the 'goal'.
- * Expected argv: [{Program Name}, {'goal'}, {'file_name'}]
+ * Expected argv: [{Program Name}, {'goal'}, {'file_name'}], or [{Program Name}, "tune"] to tune this machine.
  * Returns 0 on success.
  *
  * 'goal' - "string" that equals to one of the following: ["sym", "ddg", "norm"]
@@ -604,9 +829,24 @@ int read_file(double ***X, char **file_name, int *rows, int *cols)
  */
 int main(int argc, char *argv[])
 {
-    char *goal, *file_name;
-    double **X, **A, *D, **D_out, **W;
-    int N, d;
+    char *goal, *file_name, *quantum, *end;
+    double **X, **D_out, *degrees = NULL, grid = 0;
+    cache_entry *graph;
+    int N, d, streamed, threads, failed;
+
+    /* A missing or foreign profile leaves the untuned defaults */
+    tuning_load();
+
+    if (argc == 2 && strcmp(argv[1], TUNE) == 0)
+    {
+        if (tuning_run(stdout) != 0)
+        {
+            printf("%s", ERR_MSG);
+            return 1;
+        }
+        printf("%s\n", tuning_profile_path());
+        return 0;
+    }
 
     if (argc != 3)
     {
@@ -617,52 +857,88 @@ int main(int argc, char *argv[])
     goal = argv[1];
     file_name = argv[2];
 
-    if (read_file(&X, &file_name, &N, &d) != 0)
+    /* if goal in {'sym', 'ddg', 'norm'}, the method gets the suitable matrix and prints it. */
+    if (strcmp(goal, SYM) != 0 && strcmp(goal, DDG) != 0 && strcmp(goal, NORM) != 0)
     {
         printf("%s", ERR_MSG);
         return 1;
     }
-    /* if goal in {'sym', 'ddg', 'norm'}, the method gets the suitable matrix and prints it. */
-    if (strcmp(goal, SYM) == 0)
-    {
-        C_sym(&A, &X, N, d);
 
-        print_matrix(&A, N, N);
+    /* Without a disk store the graph dies with the process, so it is streamed row by row instead of cached */
+    streamed = getenv(CACHE_DIR_ENV) == NULL;
 
-        free_2D_array(&A, N);
+    /* Duplicate compression (SYMNMF_DEDUP) finds the degrees on the unique points, the cache keeps full graphs only */
+    quantum = getenv(DEDUP_ENV);
+    if (quantum != NULL)
+    {
+        grid = strtod(quantum, &end);
+        if (!streamed || end == quantum || *end != '\0' || !(grid >= 0))
+        {
+            printf("%s", ERR_MSG);
+            return 1;
+        }
     }
-    else if (strcmp(goal, DDG) == 0)
+
+    /* The pipelined ingest (SYMNMF_INGEST_THREADS) also finds the degrees of streamed ddg and norm while it parses */
+    threads = ingest_threads();
+    if (threads > 0 ? ingest_file(&X, streamed && strcmp(goal, SYM) != 0 && quantum == NULL ? &degrees : NULL,
+                                  &file_name, &N, &d, threads) != 0
+                    : read_file(&X, &file_name, &N, &d) != 0)
     {
-        C_sym(&A, &X, N, d);
-        C_ddg(&D, &A, N);
-        parse_diag_to_matrix_form(&D_out, &D, N);
+        printf("%s", ERR_MSG);
+        return 1;
+    }
 
-        print_matrix(&D_out, N, N);
+    if (streamed)
+    {
+        if (quantum != NULL)
+            failed = strcmp(goal, SYM) == 0   ? dedup_sym(&X, N, d, grid)
+                     : strcmp(goal, DDG) == 0 ? dedup_ddg(&X, N, d, grid)
+                                              : dedup_norm(&X, N, d, grid);
+        else
+            failed = strcmp(goal, SYM) == 0   ? stream_sym(&X, N, d)
+                     : strcmp(goal, DDG) == 0 ? stream_ddg(&X, N, d, degrees)
+                                              : stream_norm(&X, N, d, degrees);
+        if (failed)
+        {
+            printf("%s", ERR_MSG);
+            free(degrees);
+            free_2D_array(&X, N);
+            return 1;
+        }
+        free(degrees);
+        free_2D_array(&X, N);
+        return 0;
+    }
 
-        free_2D_array(&A, N);
-        free(D);
-        free_2D_array(&D_out, N);
+    /* The graph is owned by the cache, which may reuse it from the disk store (SYMNMF_CACHE_DIR) */
+    if (cache_get(&graph, &X, N, d, strcmp(goal, NORM) == 0) != 0)
+    {
+        printf("%s", ERR_MSG);
+        free_2D_array(&X, N);
+        return 1;
     }
-    else if (strcmp(goal, NORM) == 0)
+
+    if (strcmp(goal, SYM) == 0)
     {
-        C_sym(&A, &X, N, d);
-        C_ddg(&D, &A, N);
-        C_norm(&W, &D, &A, N);
+        print_matrix(&graph->A, N, N);
+    }
+    else if (strcmp(goal, DDG) == 0)
+    {
+        parse_diag_to_matrix_form(&D_out, &graph->D, N);
 
-        print_matrix(&W, N, N);
+        print_matrix(&D_out, N, N);
 
-        free_2D_array(&A, N);
-        free(D);
-        free_2D_array(&W, N);
+        free_2D_array(&D_out, N);
     }
     else
     {
-        printf("%s", ERR_MSG);
-        free_2D_array(&X, N);
-        return 1;
+        print_matrix(&graph->W, N, N);
     }
 
+    cache_clear();
     free_2D_array(&X, N);
 
     return 0;
 }
+#endif
@@ -1,19 +1,113 @@
 #ifndef SYMNMF_H
 #define SYMNMF_H
 
+#define BETA 0.5
+#define MAX_ITER 300
+#define EPS 0.0001
+
+/* Stopping rule of the Jacobi eigen solver: off diagonal mass below JACOBI_EPS of the total */
+#define JACOBI_MAX_SWEEPS 50
+#define JACOBI_EPS 1e-24
+
+/* Similarity kernel: a_ij = exp(-SYM_KERNEL_SCALE * ||x_i - x_j||^2) */
+#define SYM_KERNEL_SCALE 0.5
+
+/* Default size of the W row panel read by one stochastic step, chosen to stay cache resident */
+#define STOCHASTIC_PANEL_BYTES (1024 * 1024)
+
+/*
+ * Schedule of the stochastic row-block SymNMF mode.
+ * 'block_rows' - Rows of H updated per step, 0 for STOCHASTIC_PANEL_BYTES worth of W rows.
+ * 'check_every' - Steps between full residual checks, 0 for once per sweep over H.
+ * 'decay' - The step size of epoch e is BETA / (1 + 'decay' * e).
+ * 'seed' - Seed of the block order.
+ */
+typedef struct stochastic_schedule
+{
+    int block_rows;
+    int check_every;
+    double decay;
+    unsigned long seed;
+} stochastic_schedule;
+
+/* A step counts as stalled if it shrinks to no less than STALL_RATIO of the previous step; a growing step does not */
+#define STALL_RATIO 0.99
+
+/*
+ * Stopping rules of C_symnmf_tracked, checked after every update; the first rule that holds stops.
+ * 'max_iter' - Updates at most.
+ * 'delta_eps' - Stop once ||H_out - H_in||_F^2 < 'delta_eps'.
+ * 'rel_objective' - Stop once ||W - H * H^T||_F^2 changes by less than this fraction of itself between two
+ *   consecutive iterates, 0 for off. Both are the iterates before the last update, see symnmf_report.
+ * 'stall_iters' - Stop after this many stalled steps in a row (see STALL_RATIO), 0 for off.
+ * 'time_budget' - Stop once this many seconds have passed, 0 for off.
+ * C_symnmf uses {MAX_ITER, EPS, 0, 0, 0}.
+ */
+typedef struct stopping_rule
+{
+    int max_iter;
+    double delta_eps;
+    double rel_objective;
+    int stall_iters;
+    double time_budget;
+} stopping_rule;
+
+/* The rule that stopped a run */
+typedef enum stop_reason
+{
+    STOP_MAX_ITER = 0,
+    STOP_DELTA = 1,
+    STOP_OBJECTIVE = 2,
+    STOP_STALL = 3,
+    STOP_TIME = 4
+} stop_reason;
+
+/*
+ * Outcome of a C_symnmf_tracked run.
+ * 'prev_objective' - ||W - H * H^T||_F^2 at the previous iterate, the H the last update started from, so it lags
+ * the returned H by one update; -1 unless the 'rel_objective' rule is on, which is the only rule that needs it.
+ * 'delta' - The squared step of the last update.
+ */
+typedef struct symnmf_report
+{
+    int iterations;
+    double prev_objective;
+    double delta;
+    stop_reason reason;
+} symnmf_report;
+
 int allocate_2D_array(double ***arr, int rows, int cols);
 
 int free_2D_array(double ***arr, int rows);
 
+int print_row(const double *row, const int cols);
+
+int copy_matrix(double ***copyTo, double ***copyFrom, const int rows, const int cols);
+
 int C_sym(double ***A, double ***X, const int rows, const int cols);
 
 int C_ddg(double **D, double ***A, const int N);
 
 int C_norm(double ***W, double **D, double ***A, const int N);
 
+int update_H(double ***H_out, double ***H_in, const int rows_H, const int cols_H,
+             double ***W, const int N_W);
+
 int C_symnmf(double ***H_out, double ***H_in, const int rows_H, const int cols_H,
              double ***W, const int N_W);
 
+int C_symnmf_tracked(double ***H_out, double ***H_in, const int rows_H, const int cols_H,
+                     double ***W, const int N_W, const stopping_rule *rule, symnmf_report *report);
+
+int C_symnmf_stochastic(double ***H_out, double ***H_in, const int rows_H, const int cols_H,
+                        double ***W, const int N_W, const stochastic_schedule *schedule);
+
+unsigned long lcg_next(unsigned long *state);
+
+int jacobi_eigen(double ***V, double **lambda, double ***M, const int N);
+
 int parse_diag_to_matrix_form(double ***M, double **D, const int N);
 
+int read_file(double ***X, char **file_name, int *rows, int *cols);
+
 #endif
@@ -4,6 +4,7 @@ import symnmfmodule as s  # C module
 
 # global arguments
 goal_list = ['symnmf', 'sym', 'ddg', 'norm']
+init_list = ['random', 'nndsvd']
 
 # initializing the random function
 np.random.seed(0)
@@ -35,19 +36,18 @@ def handleError():
     exit()
 
 
-def symnmf(X, k, N):
+def initial_H(W, k, N):
     """
-    symnmf function that calls to the symnmf C function
-    :param X: input vectors in a matrix form
-    :type X: list of lists
+    random initial H for the symnmf C functions, uniform in [0, 2*sqrt(m/k)) where m is the mean of W
+    :param W: normalized similarity matrix
+    :type W: list of lists
     :param k: number of clusters
     :type k: int
-    :param N: number of vectors in X
+    :param N: number of vectors
     :type N: int
-    :return: symnmf matrix
+    :return: initial H matrix
     :rtype: list of lists (size: N*k)
     """
-    W = norm(X)
     m = np.mean(np.array(W))
     initial_h = []
     #H = np.random.uniform(0, 2*np.sqrt(m/k), (N, k)).tolist()
@@ -55,7 +55,111 @@ def symnmf(X, k, N):
         initial_h.append([])
         for j in range(k):
             initial_h[i].append(2 * np.sqrt(m / k) * np.random.uniform())
-    return s.symnmf(initial_h, W)
+    return initial_h
+
+
+def symnmf(X, k, N, init="random", rel_objective=0.0, stall_iters=0, time_budget=0.0):
+    """
+    symnmf function that calls to the symnmf C function
+    :param X: input vectors in a matrix form
+    :type X: list of lists
+    :param k: number of clusters
+    :type k: int
+    :param N: number of vectors in X
+    :type N: int
+    :param init: initial H, one of init_list
+    :type init: str
+    :param rel_objective: stop once ||W - HH^T||^2 changes by less than this fraction of itself between two
+        iterates, 0 for off; s.report() then gives the objective one update before the result
+    :type rel_objective: float
+    :param stall_iters: stop after this many steps in a row that barely shrink, 0 for off
+    :type stall_iters: int
+    :param time_budget: stop after this many seconds, 0 for off
+    :type time_budget: float
+    :return: symnmf matrix, see s.report() for how the run stopped
+    :rtype: list of lists (size: N*k)
+    """
+    W = norm(X)
+    if init == "nndsvd":
+        return s.symnmf(s.init_nndsvd(W, k), W, rel_objective, stall_iters, time_budget)
+    return s.symnmf(initial_H(W, k, N), W, rel_objective, stall_iters, time_budget)
+
+
+def symnmf_stochastic(X, k, N, block_rows=0, check_every=0, decay=0.0, seed=0):
+    """
+    symnmf_stochastic function that calls to the stochastic row-block symnmf C function
+    :param X: input vectors in a matrix form
+    :type X: list of lists
+    :param k: number of clusters
+    :type k: int
+    :param N: number of vectors in X
+    :type N: int
+    :param block_rows: rows of H updated per step, 0 for a cache sized default
+    :type block_rows: int
+    :param check_every: steps between full residual checks, 0 for once per sweep
+    :type check_every: int
+    :param decay: step size decay per sweep
+    :type decay: float
+    :param seed: seed of the block order
+    :type seed: int
+    :return: symnmf matrix
+    :rtype: list of lists (size: N*k)
+    """
+    W = norm(X)
+    return s.symnmf_stochastic(initial_H(W, k, N), W, block_rows, check_every, decay, seed)
+
+
+def symnmf_nystrom(X, k, m, seed=0):
+    """
+    symnmf_nystrom function that calls to the Nystrom low-rank symnmf C function
+    :param X: input vectors in a matrix form
+    :type X: list of lists
+    :param k: number of clusters
+    :type k: int
+    :param m: number of landmark points
+    :type m: int
+    :param seed: seed of the landmark sample and of the initial H
+    :type seed: int
+    :return: symnmf matrix
+    :rtype: list of lists (size: N*k)
+    """
+    return s.symnmf_nystrom(X, k, m, seed)
+
+
+def symnmf_knn(X, k, neighbours, effort=0, seed=0):
+    """
+    symnmf_knn function that calls to the sparse kNN graph symnmf C function
+    :param X: input vectors in a matrix form
+    :type X: list of lists
+    :param k: number of clusters
+    :type k: int
+    :param neighbours: nearest neighbours kept per point
+    :type neighbours: int
+    :param effort: leaves per query (KD-tree) or list size (NN-descent), 0 for exact (KD-tree) or 2 * neighbours
+    :type effort: int
+    :param seed: seed of the index and of the initial H
+    :type seed: int
+    :return: symnmf matrix
+    :rtype: list of lists (size: N*k)
+    """
+    return s.symnmf_knn(X, k, neighbours, effort, seed)
+
+
+def symnmf_dedup(X, k, quantum=0.0, seed=0):
+    """
+    symnmf_dedup function that calls to the duplicate compressed symnmf C function
+    :param X: input vectors in a matrix form
+    :type X: list of lists
+    :param k: number of clusters
+    :type k: int
+    :param quantum: grid of the near duplicates, 0 for exact duplicates only
+    :type quantum: float
+    :param seed: seed of the initial H
+    :type seed: int
+    :return: symnmf matrix, equal rows for duplicate vectors
+    :rtype: list of lists (size: N*k)
+    """
+    return s.symnmf_dedup(X, k, quantum, seed)
 
 
 def sym(X):
@@ -107,7 +211,7 @@ if __name__ == "__main__":
     """
     performs symNMF (symmetric Non-negative Matrix Factorization and prints the result
     """
-    if len(sys.argv) != 4:  # missing argument
+    if len(sys.argv) not in (4, 5):  # missing argument
         handleError()
 
     # Initializing arguments
@@ -115,9 +219,13 @@ if __name__ == "__main__":
         K = int(sys.argv[1])
         goal = str(sys.argv[2])
         filename = str(sys.argv[3])
+        init = str(sys.argv[4]) if len(sys.argv) == 5 else init_list[0]
     except:
         handleError()
 
+    if init not in init_list or (init != init_list[0] and goal != goal_list[0]):
+        handleError()
+
     if goal not in goal_list:  # check if goal is in the list of allowed values
         handleError()
 
@@ -134,7 +242,7 @@ if __name__ == "__main__":
         X = createDVectors(file)
 
     if goal == goal_list[0]:
-        resMat = eval(goal)(X, K, N)
+        resMat = eval(goal)(X, K, N, init)
     else:
         resMat = eval(goal)(X)
 
@@ -0,0 +1,749 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "symnmf.h"
+#include "dist.h"
+#include "nystrom.h"
+#include "knn.h"
+#include "init.h"
+#include "placement.h"
+#include "kernels.h"
+#include "ingest.h"
+#include "isa.h"
+#include "dedup.h"
+
+/*
+ * Benchmarks of the SymNMF engines on synthetic data.
+ * Usage: symnmf_bench {mode} [args...], every mode prints CSV to stdout.
+ */
+
+#define USAGE "Usage: symnmf_bench dist N d k P\n" \
+              "       symnmf_bench nystrom N d k m1,m2,...\n" \
+              "       symnmf_bench knn N d n_neighbours e1,e2,...\n" \
+              "       symnmf_bench init N d k\n" \
+              "       symnmf_bench placement N k reps\n" \
+              "       symnmf_bench ingest N d t1,t2,...\n" \
+              "       symnmf_bench dedup N d k f1,f2,...\n" \
+              "       symnmf_bench stopping N d k\n"
+
+/*
+ * Returns the monotonic wall clock in seconds.
+ */
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Fills '*M' with uniform random values in [0, 'scale').
+ * pre: '*M' is NOT dynamically allocated.
+ * Returns 0 on success.
+ */
+static int random_matrix(double ***M, const int rows, const int cols, const double scale)
+{
+    int i, j;
+    if (allocate_2D_array(M, rows, cols) != 0)
+        return 1;
+    for (i = 0; i < rows; i++)
+    {
+        for (j = 0; j < cols; j++)
+            (*M)[i][j] = scale * rand() / ((double)RAND_MAX + 1);
+    }
+    return 0;
+}
+
+/*
+ * Builds the normalized similarity matrix '*W' of 'N' random points of dimension 'd'.
+ * pre: '*W' is NOT dynamically allocated.
+ * Returns 0 on success.
+ */
+static int random_graph(double ***W, const int N, const int d)
+{
+    double **X, **A, *D;
+    if (random_matrix(&X, N, d, 1.0) != 0)
+        return 1;
+    if (C_sym(&A, &X, N, d) != 0 || C_ddg(&D, &A, N) != 0 || C_norm(W, &D, &A, N) != 0)
+        return 1;
+    free_2D_array(&X, N);
+    free_2D_array(&A, N);
+    free(D);
+    return 0;
+}
+
+/*
+ * Initial H as in symnmf.py: uniform in [0, 2 * sqrt(mean(W) / k)].
+ */
+static int initial_H(double ***H, double ***W, const int N, const int k)
+{
+    double mean = 0;
+    int i, j;
+    for (i = 0; i < N; i++)
+    {
+        for (j = 0; j < N; j++)
+            mean += (*W)[i][j];
+    }
+    mean /= (double)N * N;
+    return random_matrix(H, N, k, 2 * sqrt(mean / k));
+}
+
+/*
+ * Strong scaling of the row-partitioned engine over 1..P workers.
+ * Output: workers,seconds,speedup
+ */
+static int bench_dist(int argc, char *argv[])
+{
+    int N, d, k, P, p;
+    double **W, **H_init, **H_run, **H_out, t0, t1, base = 0;
+
+    if (argc != 6)
+        return 1;
+    N = atoi(argv[2]);
+    d = atoi(argv[3]);
+    k = atoi(argv[4]);
+    P = atoi(argv[5]);
+    if (N < 2 || d < 1 || k < 1 || P < 1 || P > N)
+        return 1;
+
+    if (random_graph(&W, N, d) != 0 || initial_H(&H_init, &W, N, k) != 0 || allocate_2D_array(&H_run, N, k) != 0)
+        return 1;
+
+    printf("workers,seconds,speedup\n");
+    for (p = 1; p <= P; p++)
+    {
+        copy_matrix(&H_run, &H_init, N, k);
+        t0 = now_seconds();
+        if (C_symnmf_distributed(&H_out, &H_run, N, k, &W, N, p, &shm_backend) != 0)
+            return 1;
+        t1 = now_seconds();
+        if (p == 1)
+            base = t1 - t0;
+        printf("%d,%.6f,%.3f\n", p, t1 - t0, base / (t1 - t0));
+        fflush(stdout);
+        free_2D_array(&H_out, N);
+    }
+
+    free_2D_array(&W, N);
+    free_2D_array(&H_init, N);
+    free_2D_array(&H_run, N);
+    return 0;
+}
+
+/*
+ * Returns the index of the largest entry of 'row'.
+ */
+static int argmax(const double *row, const int len)
+{
+    int j, best = 0;
+    for (j = 1; j < len; j++)
+    {
+        if (row[j] > row[best])
+            best = j;
+    }
+    return best;
+}
+
+/*
+ * Accuracy of the Nystrom mode against the exact W for every landmark count m.
+ * Output: m,rank,rel_error,build_seconds,symnmf_seconds,label_agreement
+ * 'rel_error' is ||W - W_m||_F / ||W||_F, 'label_agreement' the fraction of points whose
+ * argmax cluster matches the exact SymNMF run from the same initial H.
+ */
+static int bench_nystrom(int argc, char *argv[])
+{
+    int N, d, k, m, i, j, b, agree;
+    double **X, **A, *D, **W, **H_init, **H_run, **H_exact, **H_low, t0, t1, t2, err, ref, w_hat;
+    char *list;
+    lowrank_graph L;
+
+    if (argc != 6)
+        return 1;
+    N = atoi(argv[2]);
+    d = atoi(argv[3]);
+    k = atoi(argv[4]);
+    if (N < 2 || d < 1 || k < 1 || k >= N)
+        return 1;
+
+    if (random_matrix(&X, N, d, 1.0) != 0 || C_sym(&A, &X, N, d) != 0 || C_ddg(&D, &A, N) != 0 ||
+        C_norm(&W, &D, &A, N) != 0)
+        return 1;
+    if (initial_H(&H_init, &W, N, k) != 0 || allocate_2D_array(&H_run, N, k) != 0)
+        return 1;
+    copy_matrix(&H_run, &H_init, N, k);
+    if (C_symnmf(&H_exact, &H_run, N, k, &W, N) != 0)
+        return 1;
+
+    printf("m,rank,rel_error,build_seconds,symnmf_seconds,label_agreement\n");
+    for (list = strtok(argv[5], ","); list != NULL; list = strtok(NULL, ","))
+    {
+        m = atoi(list);
+        t0 = now_seconds();
+        if (C_nystrom_norm(&L, &X, N, d, m, 0) != 0)
+        {
+            printf("%d,,,,,\n", m);
+            continue;
+        }
+        t1 = now_seconds();
+        copy_matrix(&H_run, &H_init, N, k);
+        if (C_symnmf_lowrank(&H_low, &H_run, N, k, &L) != 0)
+            return 1;
+        t2 = now_seconds();
+
+        err = 0;
+        ref = 0;
+        for (i = 0; i < N; i++)
+        {
+            for (j = 0; j < N; j++)
+            {
+                w_hat = i == j ? -L.s[i] : 0;
+                for (b = 0; b < L.rank; b++)
+                    w_hat += L.G[i][b] * L.G[j][b];
+                err += (W[i][j] - w_hat) * (W[i][j] - w_hat);
+                ref += W[i][j] * W[i][j];
+            }
+        }
+        agree = 0;
+        for (i = 0; i < N; i++)
+            agree += argmax(H_exact[i], k) == argmax(H_low[i], k);
+
+        printf("%d,%d,%.6f,%.6f,%.6f,%.4f\n", m, L.rank, sqrt(err / ref), t1 - t0, t2 - t1, (double)agree / N);
+        fflush(stdout);
+        free_lowrank(&L);
+        free_2D_array(&H_low, N);
+    }
+
+    free_2D_array(&X, N);
+    free_2D_array(&A, N);
+    free(D);
+    free_2D_array(&W, N);
+    free_2D_array(&H_init, N);
+    free_2D_array(&H_run, N);
+    free_2D_array(&H_exact, N);
+    return 0;
+}
+
+/*
+ * Recall and speed of the kNN index against brute force for every effort e, 0 being the index's default.
+ * Output: effort,index,seconds,brute_seconds,speedup,recall
+ */
+static int bench_knn(int argc, char *argv[])
+{
+    int N, d, n_neighbours, effort;
+    double **X, t0, t1, brute;
+    char *list;
+    knn_graph exact, G;
+
+    if (argc != 6)
+        return 1;
+    N = atoi(argv[2]);
+    d = atoi(argv[3]);
+    n_neighbours = atoi(argv[4]);
+    if (N < 2 || d < 1 || n_neighbours < 1 || n_neighbours >= N)
+        return 1;
+
+    if (random_matrix(&X, N, d, 1.0) != 0)
+        return 1;
+    t0 = now_seconds();
+    if (C_knn_brute(&exact, &X, N, d, n_neighbours) != 0)
+        return 1;
+    brute = now_seconds() - t0;
+
+    printf("effort,index,seconds,brute_seconds,speedup,recall\n");
+    for (list = strtok(argv[5], ","); list != NULL; list = strtok(NULL, ","))
+    {
+        effort = atoi(list);
+        t0 = now_seconds();
+        if (C_knn(&G, &X, N, d, n_neighbours, effort, 0) != 0)
+            return 1;
+        t1 = now_seconds();
+        printf("%d,%s,%.6f,%.6f,%.2f,%.4f\n", effort, d <= KNN_KDTREE_MAX_DIM ? "kdtree" : "nndescent", t1 - t0,
+               brute, brute / (t1 - t0), knn_recall(&G, &exact));
+        fflush(stdout);
+        free_knn(&G);
+    }
+
+    free_knn(&exact);
+    free_2D_array(&X, N);
+    return 0;
+}
+
+/*
+ * Fills '*X' with 'N' points of 'k' clusters: point i is in cluster c = i mod k, centered at
+ * 4 * (1 + c / d) * e_(c mod d), with about unit variance per coordinate.
+ * pre: '*X' is NOT dynamically allocated.
+ * Returns 0 on success.
+ */
+static int clustered_matrix(double ***X, const int N, const int d, const int k)
+{
+    int i, j, t;
+    if (allocate_2D_array(X, N, d) != 0)
+        return 1;
+    for (i = 0; i < N; i++)
+    {
+        for (j = 0; j < d; j++)
+        {
+            (*X)[i][j] = -6;
+            for (t = 0; t < 12; t++)
+                (*X)[i][j] += rand() / ((double)RAND_MAX + 1);
+        }
+        (*X)[i][(i % k) % d] += 4 * (1 + (i % k) / d);
+    }
+    return 0;
+}
+
+/*
+ * Runs the updates of C_symnmf from '*H' until the same stopping rule holds, counting them.
+ * Returns the number of iterations, -1 on failure. '*H' holds the final H.
+ */
+static int iterate_to_eps(double ***H, double ***W, const int N, const int k)
+{
+    double **H_next, delta = EPS + 1, diff;
+    int iter, i, j;
+
+    if (allocate_2D_array(&H_next, N, k) != 0)
+        return -1;
+    for (iter = 0; iter < MAX_ITER && delta >= EPS; iter++)
+    {
+        if (update_H(&H_next, H, N, k, W, N) != 0)
+        {
+            free_2D_array(&H_next, N);
+            return -1;
+        }
+        delta = 0;
+        for (i = 0; i < N; i++)
+        {
+            for (j = 0; j < k; j++)
+            {
+                diff = H_next[i][j] - (*H)[i][j];
+                delta += diff * diff;
+            }
+        }
+        copy_matrix(H, &H_next, N, k);
+    }
+    free_2D_array(&H_next, N);
+    return iter;
+}
+
+/*
+ * Returns ||W - H * H^T||_F^2.
+ */
+static double objective(double ***W, double ***H, const int N, const int k)
+{
+    double total = 0, r;
+    int i, j, c;
+    for (i = 0; i < N; i++)
+    {
+        for (j = 0; j < N; j++)
+        {
+            r = (*W)[i][j];
+            for (c = 0; c < k; c++)
+                r -= (*H)[i][c] * (*H)[j][c];
+            total += r * r;
+        }
+    }
+    return total;
+}
+
+/*
+ * Iterations and wall time to reach EPS from the random initial H of symnmf.py and from the NNDSVD-style one,
+ * on 'k' Gaussian clusters of N / k points each.
+ * Output: init,init_seconds,iterations,symnmf_seconds,objective
+ */
+static int bench_init(int argc, char *argv[])
+{
+    int N, d, k, iters, nndsvd;
+    double **X, **A, *D, **W, **H, t0, t1, t2;
+
+    if (argc != 5)
+        return 1;
+    N = atoi(argv[2]);
+    d = atoi(argv[3]);
+    k = atoi(argv[4]);
+    if (N < 2 || d < 1 || k < 1 || k >= N)
+        return 1;
+
+    if (clustered_matrix(&X, N, d, k) != 0)
+        return 1;
+    if (C_sym(&A, &X, N, d) != 0 || C_ddg(&D, &A, N) != 0 || C_norm(&W, &D, &A, N) != 0)
+        return 1;
+
+    printf("init,init_seconds,iterations,symnmf_seconds,objective\n");
+    for (nndsvd = 0; nndsvd <= 1; nndsvd++)
+    {
+        t0 = now_seconds();
+        if ((nndsvd ? C_init_nndsvd(&H, &W, N, k, 0) : initial_H(&H, &W, N, k)) != 0)
+            return 1;
+        t1 = now_seconds();
+        iters = iterate_to_eps(&H, &W, N, k);
+        if (iters < 0)
+            return 1;
+        t2 = now_seconds();
+        printf("%s,%.6f,%d,%.6f,%.6f\n", nndsvd ? "nndsvd" : "random", t1 - t0, iters, t2 - t1,
+               objective(&W, &H, N, k));
+        fflush(stdout);
+        free_2D_array(&H, N);
+    }
+
+    free_2D_array(&X, N);
+    free_2D_array(&A, N);
+    free(D);
+    free_2D_array(&W, N);
+    return 0;
+}
+
+/*
+ * Opens a counter of the data TLB read misses of this process.
+ * Returns its descriptor, or -1 where perf events are not available.
+ */
+static int open_dtlb_counter(void)
+{
+#if defined(__linux__) && defined(SYS_perf_event_open)
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0UL);
+#else
+    return -1;
+#endif
+}
+
+/*
+ * W * H over an N x N matrix allocated with every placement policy, 'off' being the per-row allocation.
+ * Output: policy,applied,pages,seconds,gb_per_sec,dtlb_misses
+ * 'applied' is the policy the kernel accepted, 'dtlb_misses' is -1 where perf events are not available.
+ */
+static int bench_placement(int argc, char *argv[])
+{
+    static const char *policies[] = {"off", "local", "interleave", "partition"};
+    static const char *kinds[] = {"small", "thp", "hugetlb"};
+    const symnmf_kernels *kernels;
+    const placement_report *report;
+    int N, k, reps, p, r, i, j, fd;
+    double **W, **H, **out, t0, t1;
+    long misses;
+
+    if (argc != 5)
+        return 1;
+    N = atoi(argv[2]);
+    k = atoi(argv[3]);
+    reps = atoi(argv[4]);
+    if (N < 2 || k < 1 || reps < 1)
+        return 1;
+
+    kernels = select_kernels(k);
+    if (random_matrix(&H, N, k, 1.0) != 0 || allocate_2D_array(&out, N, k) != 0)
+        return 1;
+    fd = open_dtlb_counter();
+
+    printf("policy,applied,pages,seconds,gb_per_sec,dtlb_misses\n");
+    for (p = 0; p < 4; p++)
+    {
+        setenv(PLACEMENT_ENV, policies[p], 1);
+        if (allocate_matrix(&W, N, N) != 0)
+            return 1;
+        report = placement_last();
+        for (i = 0; i < N; i++)
+        {
+            for (j = 0; j < N; j++)
+                W[i][j] = rand() / ((double)RAND_MAX + 1);
+        }
+
+        misses = -1;
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        t0 = now_seconds();
+        for (r = 0; r < reps; r++)
+            kernels->mul_rows(out, W, H, N, 0, N, k);
+        t1 = now_seconds();
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+                misses = -1;
+        }
+
+        printf("%s,%s,%s,%.6f,%.3f,%ld\n", policies[p], policies[p == 0 ? 0 : report->policy],
+               p == 0 ? kinds[0] : kinds[report->pages], t1 - t0,
+               (double)N * N * sizeof(double) * reps / (t1 - t0) / 1e9, misses);
+        fflush(stdout);
+        free_2D_array(&W, N);
+    }
+
+    if (fd >= 0)
+        close(fd);
+    free_2D_array(&H, N);
+    free_2D_array(&out, N);
+    return 0;
+}
+
+/*
+ * Wall time from a file of 'N' random points to their degrees: read_file followed by the degree sums, against
+ * the pipelined ingest with t threads, which parses and sums at once.
+ * Output: threads,seconds,speedup,max_rel_diff
+ * 'threads' 0 is the sequential baseline, 'max_rel_diff' compares the degrees with it.
+ */
+static int bench_ingest(int argc, char *argv[])
+{
+    const isa_kernels *isa = isa_select();
+    char path[] = "/tmp/symnmf_bench_XXXXXX", *name = path;
+    int N, d, threads, i, j, fd;
+    double **X, *D_seq, *D, t0, base, a_ij, diff, worst;
+    char *list;
+    FILE *file;
+
+    if (argc != 5)
+        return 1;
+    N = atoi(argv[2]);
+    d = atoi(argv[3]);
+    if (N < 2 || d < 1)
+        return 1;
+
+    fd = mkstemp(path);
+    file = fd < 0 ? NULL : fdopen(fd, "w");
+    if (file == NULL)
+        return 1;
+    for (i = 0; i < N; i++)
+    {
+        for (j = 0; j < d; j++)
+            fprintf(file, "%.6f%c", rand() / ((double)RAND_MAX + 1), j == d - 1 ? '\n' : ',');
+    }
+    fclose(file);
+
+    t0 = now_seconds();
+    if (read_file(&X, &name, &N, &d) != 0)
+        return 1;
+    D_seq = (double *)calloc(N, sizeof(double));
+    if (D_seq == NULL)
+        return 1;
+    for (i = 0; i < N; i++)
+    {
+        for (j = i + 1; j < N; j++)
+        {
+            a_ij = exp(-SYM_KERNEL_SCALE * isa->dist2(X[i], X[j], d));
+            D_seq[i] += a_ij;
+            D_seq[j] += a_ij;
+        }
+    }
+    base = now_seconds() - t0;
+    free_2D_array(&X, N);
+
+    printf("threads,seconds,speedup,max_rel_diff\n0,%.6f,1.00,0\n", base);
+    for (list = strtok(argv[4], ","); list != NULL; list = strtok(NULL, ","))
+    {
+        threads = atoi(list);
+        t0 = now_seconds();
+        if (threads < 1 || ingest_file(&X, &D, &name, &N, &d, threads) != 0)
+            return 1;
+        t0 = now_seconds() - t0;
+        worst = 0;
+        for (i = 0; i < N; i++)
+        {
+            diff = fabs(D[i] - D_seq[i]) / D_seq[i];
+            worst = diff > worst ? diff : worst;
+        }
+        printf("%d,%.6f,%.2f,%.3g\n", threads, t0, base / t0, worst);
+        fflush(stdout);
+        free(D);
+        free_2D_array(&X, N);
+    }
+
+    remove(path);
+    free(D_seq);
+    return 0;
+}
+
+/*
+ * Full against duplicate compressed SymNMF on 'N' rows drawn from N / f unique points, for each duplication
+ * factor f. Both runs start from the same H, equal for copies, so they agree up to rounding.
+ * Output: factor,unique,full_seconds,dedup_seconds,speedup,max_h_diff
+ */
+static int bench_dedup(int argc, char *argv[])
+{
+    int N, d, k, f, n, i, c;
+    double **P, **X, **A, *D, **W, **U, **W_u, **H_u, **H, **H_full, **H_dedup, **H_out, t0, t1, t2, diff;
+    char *list;
+    dedup_map map;
+
+    if (argc != 6)
+        return 1;
+    N = atoi(argv[2]);
+    d = atoi(argv[3]);
+    k = atoi(argv[4]);
+    if (N < 2 || d < 1 || k < 1 || k >= N)
+        return 1;
+
+    printf("factor,unique,full_seconds,dedup_seconds,speedup,max_h_diff\n");
+    for (list = strtok(argv[5], ","); list != NULL; list = strtok(NULL, ","))
+    {
+        f = atoi(list);
+        n = f > 0 ? N / f : 0;
+        if (n <= k || random_matrix(&P, n, d, 2.0) != 0 || allocate_2D_array(&X, N, d) != 0)
+            return 1;
+        for (i = 0; i < N; i++)
+            memcpy(X[i], P[i < n ? i : rand() % n], d * sizeof(double));
+
+        if (C_dedup(&U, &map, &X, N, d, 0) != 0 || C_dedup_norm(&W_u, &U, d, &map) != 0 ||
+            random_matrix(&H_u, map.n, k, 2 * sqrt(dedup_mean(&W_u, &map) / k)) != 0 ||
+            expand_rows(&H, &H_u, k, &map) != 0)
+            return 1;
+        free_2D_array(&W_u, map.n);
+        free_2D_array(&U, map.n);
+        free_dedup(&map);
+
+        t0 = now_seconds();
+        if (C_sym(&A, &X, N, d) != 0 || C_ddg(&D, &A, N) != 0 || C_norm(&W, &D, &A, N) != 0 ||
+            C_symnmf(&H_full, &H, N, k, &W, N) != 0)
+            return 1;
+        t1 = now_seconds();
+        if (C_dedup(&U, &map, &X, N, d, 0) != 0 || C_dedup_norm(&W_u, &U, d, &map) != 0 ||
+            C_symnmf_weighted(&H_out, &H_u, k, &W_u, &map) != 0 || expand_rows(&H_dedup, &H_out, k, &map) != 0)
+            return 1;
+        t2 = now_seconds();
+
+        diff = 0;
+        for (i = 0; i < N; i++)
+        {
+            for (c = 0; c < k; c++)
+                diff = fabs(H_full[i][c] - H_dedup[i][c]) > diff ? fabs(H_full[i][c] - H_dedup[i][c]) : diff;
+        }
+        printf("%d,%d,%.6f,%.6f,%.2f,%.3g\n", f, map.n, t1 - t0, t2 - t1, (t1 - t0) / (t2 - t1), diff);
+        fflush(stdout);
+
+        free_2D_array(&P, n);
+        free_2D_array(&X, N);
+        free_2D_array(&A, N);
+        free(D);
+        free_2D_array(&W, N);
+        free_2D_array(&H, N);
+        free_2D_array(&H_full, N);
+        free_2D_array(&H_u, map.n);
+        free_2D_array(&H_out, map.n);
+        free_2D_array(&H_dedup, N);
+        free_2D_array(&W_u, map.n);
+        free_2D_array(&U, map.n);
+        free_dedup(&map);
+    }
+    return 0;
+}
+
+/*
+ * C_symnmf_tracked from the same initial H under each stopping rule, against the default rule of C_symnmf.
+ * 'objective' is the direct one at the H the last update started from; 'objective_error' compares the tracked
+ * prev_objective against it, -1 for the rules that do not track it.
+ * Output: rule,iterations,seconds,objective,objective_error,reason
+ */
+static int bench_stopping(int argc, char *argv[])
+{
+    static const char *names[] = {"default", "rel_objective=1e-4", "rel_objective=1e-6", "stall=10", "time=0.05"};
+    static const char *reasons[] = {"max_iter", "delta", "objective", "stall", "time"};
+    stopping_rule rules[5] = {{MAX_ITER, EPS, 0, 0, 0},
+                              {MAX_ITER, EPS, 1e-4, 0, 0},
+                              {MAX_ITER, EPS, 1e-6, 0, 0},
+                              {MAX_ITER, EPS, 0, 10, 0},
+                              {MAX_ITER, EPS, 0, 0, 0.05}};
+    int N, d, k, r;
+    double **X, **A, *D, **W, **H_init, **H, **H_out, **H_prev, t0, t1, direct;
+    symnmf_report report;
+
+    if (argc != 5)
+        return 1;
+    N = atoi(argv[2]);
+    d = atoi(argv[3]);
+    k = atoi(argv[4]);
+    if (N < 2 || d < 1 || k < 1 || k >= N)
+        return 1;
+
+    if (clustered_matrix(&X, N, d, k) != 0)
+        return 1;
+    if (C_sym(&A, &X, N, d) != 0 || C_ddg(&D, &A, N) != 0 || C_norm(&W, &D, &A, N) != 0)
+        return 1;
+    if (initial_H(&H_init, &W, N, k) != 0 || allocate_2D_array(&H, N, k) != 0 ||
+        allocate_2D_array(&H_prev, N, k) != 0)
+        return 1;
+
+    printf("rule,iterations,seconds,objective,objective_error,reason\n");
+    for (r = 0; r < 5; r++)
+    {
+        /* One update short of the run gives the H its last update started from */
+        copy_matrix(&H, &H_init, N, k);
+        t0 = now_seconds();
+        if (C_symnmf_tracked(&H_out, &H, N, k, &W, N, &rules[r], &report) != 0)
+            return 1;
+        t1 = now_seconds();
+        free_2D_array(&H_out, N);
+
+        rules[r].max_iter = report.iterations - 1;
+        rules[r].time_budget = 0;
+        copy_matrix(&H_prev, &H_init, N, k);
+        if (rules[r].max_iter > 0 && C_symnmf_tracked(&H_out, &H_prev, N, k, &W, N, &rules[r], NULL) != 0)
+            return 1;
+        if (rules[r].max_iter > 0)
+            free_2D_array(&H_out, N);
+
+        direct = objective(&W, &H_prev, N, k);
+        printf("%s,%d,%.6f,%.6f,%.3g,%s\n", names[r], report.iterations, t1 - t0, direct,
+               report.prev_objective >= 0 ? fabs(report.prev_objective - direct) : -1, reasons[report.reason]);
+        fflush(stdout);
+    }
+
+    free_2D_array(&X, N);
+    free_2D_array(&A, N);
+    free(D);
+    free_2D_array(&W, N);
+    free_2D_array(&H_init, N);
+    free_2D_array(&H, N);
+    free_2D_array(&H_prev, N);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int status = 1;
+
+    srand(0);
+    if (argc >= 2 && strcmp(argv[1], "dist") == 0)
+        status = bench_dist(argc, argv);
+    else if (argc >= 2 && strcmp(argv[1], "nystrom") == 0)
+        status = bench_nystrom(argc, argv);
+    else if (argc >= 2 && strcmp(argv[1], "knn") == 0)
+        status = bench_knn(argc, argv);
+    else if (argc >= 2 && strcmp(argv[1], "init") == 0)
+        status = bench_init(argc, argv);
+    else if (argc >= 2 && strcmp(argv[1], "placement") == 0)
+        status = bench_placement(argc, argv);
+    else if (argc >= 2 && strcmp(argv[1], "ingest") == 0)
+        status = bench_ingest(argc, argv);
+    else if (argc >= 2 && strcmp(argv[1], "dedup") == 0)
+        status = bench_dedup(argc, argv);
+    else if (argc >= 2 && strcmp(argv[1], "stopping") == 0)
+        status = bench_stopping(argc, argv);
+    else
+    {
+        printf("%s", USAGE);
+        return 1;
+    }
+
+    if (status != 0)
+        printf("An Error Has Occurred\n");
+    return status;
+}
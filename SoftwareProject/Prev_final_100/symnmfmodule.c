@@ -3,7 +3,16 @@
 #include "Python.h"
 #include <stdlib.h>
 #include "symnmf.h"
+#include "cache.h"
+#include "dist.h"
+#include "nystrom.h"
+#include "knn.h"
+#include "init.h"
+#include "placement.h"
+#include "tune.h"
+#include "dedup.h"
 #include <stdio.h>
+#include <math.h>
 
 /*
  * Parsing PyObject list of lists '*PyArray_2D' to array '*CArray_2D'.
@@ -77,16 +86,21 @@ int parse_2D_array_to_PyObject(PyObject **PyArray_2D, double ***CArray_2D, const
     }
     return 0;
 }
+/* Outcome of the last symnmf call, see report */
+static symnmf_report last_report = {0, -1, 0, STOP_MAX_ITER};
+
 /*
  * Returns the optimal H matrix based on the instructions or NULL on failure.
+ * Expected args: (H_init, W[, rel_objective[, stall_iters[, time_budget]]]), see stopping_rule.
  */
 static PyObject *symnmf(PyObject *self, PyObject *args) {
     PyObject *PyH_init, *PyH_out, *PyW;
     double **CH_init, **CH_out, **CW;
     int N_W, rows_H, cols_H;
+    stopping_rule rule = {MAX_ITER, EPS, 0, 0, 0};
 
-
-    if (!PyArg_ParseTuple(args, "OO", &PyH_init, &PyW))
+    if (!PyArg_ParseTuple(args, "OO|did", &PyH_init, &PyW, &rule.rel_objective, &rule.stall_iters,
+                          &rule.time_budget))
         return NULL;
 
     if (parse_PyObject_to_2D_array(&PyH_init, &CH_init, &rows_H, &cols_H) != 0)
@@ -94,7 +108,7 @@ static PyObject *symnmf(PyObject *self, PyObject *args) {
     if (parse_PyObject_to_2D_array(&PyW, &CW, &N_W, &N_W) != 0)
         return NULL;
 
-    if (C_symnmf(&CH_out, &CH_init, rows_H, cols_H, &CW, N_W) != 0) {
+    if (C_symnmf_tracked(&CH_out, &CH_init, rows_H, cols_H, &CW, N_W, &rule, &last_report) != 0) {
         free_2D_array(&CH_init, rows_H);
         free_2D_array(&CH_out, rows_H);
         free_2D_array(&CW, N_W);
@@ -111,12 +125,276 @@ static PyObject *symnmf(PyObject *self, PyObject *args) {
     return PyH_out;
 }
 
+/*
+ * Returns the H matrix of the stochastic row-block mode or NULL on failure.
+ * Expected args: (H_init, W[, block_rows[, check_every[, decay[, seed]]]])
+ */
+static PyObject *symnmf_stochastic(PyObject *self, PyObject *args) {
+    PyObject *PyH_init, *PyH_out, *PyW;
+    double **CH_init, **CH_out, **CW;
+    int N_W, rows_H, cols_H;
+    stochastic_schedule schedule = {0, 0, 0.0, 0};
+
+    if (!PyArg_ParseTuple(args, "OO|iidk", &PyH_init, &PyW, &schedule.block_rows,
+                          &schedule.check_every, &schedule.decay, &schedule.seed))
+        return NULL;
+
+    if (parse_PyObject_to_2D_array(&PyH_init, &CH_init, &rows_H, &cols_H) != 0)
+        return NULL;
+    if (parse_PyObject_to_2D_array(&PyW, &CW, &N_W, &N_W) != 0) {
+        free_2D_array(&CH_init, rows_H);
+        return NULL;
+    }
+
+    if (C_symnmf_stochastic(&CH_out, &CH_init, rows_H, cols_H, &CW, N_W, &schedule) != 0) {
+        free_2D_array(&CH_init, rows_H);
+        free_2D_array(&CW, N_W);
+        return NULL;
+    }
+
+    if (parse_2D_array_to_PyObject(&PyH_out, &CH_out, rows_H, cols_H) != 0)
+        PyH_out = NULL;
+
+    free_2D_array(&CH_init, rows_H);
+    free_2D_array(&CH_out, rows_H);
+    free_2D_array(&CW, N_W);
+
+    return PyH_out;
+}
+
+/*
+ * Returns the H matrix of the row-partitioned multi-process engine or NULL on failure.
+ * Expected args: (H_init, W, workers)
+ */
+static PyObject *symnmf_distributed(PyObject *self, PyObject *args) {
+    PyObject *PyH_init, *PyH_out, *PyW;
+    double **CH_init, **CH_out, **CW;
+    int N_W, rows_H, cols_H, workers;
+
+    if (!PyArg_ParseTuple(args, "OOi", &PyH_init, &PyW, &workers))
+        return NULL;
+
+    if (parse_PyObject_to_2D_array(&PyH_init, &CH_init, &rows_H, &cols_H) != 0)
+        return NULL;
+    if (parse_PyObject_to_2D_array(&PyW, &CW, &N_W, &N_W) != 0) {
+        free_2D_array(&CH_init, rows_H);
+        return NULL;
+    }
+
+    if (C_symnmf_distributed(&CH_out, &CH_init, rows_H, cols_H, &CW, N_W, workers, &shm_backend) != 0) {
+        free_2D_array(&CH_init, rows_H);
+        free_2D_array(&CW, N_W);
+        return NULL;
+    }
+
+    if (parse_2D_array_to_PyObject(&PyH_out, &CH_out, rows_H, cols_H) != 0)
+        PyH_out = NULL;
+
+    free_2D_array(&CH_init, rows_H);
+    free_2D_array(&CH_out, rows_H);
+    free_2D_array(&CW, N_W);
+
+    return PyH_out;
+}
+
+/*
+ * Returns the H matrix of the Nystrom low-rank mode or NULL on failure.
+ * W is approximated from 'm' random landmarks and never built, H starts uniform in [0, 2 * sqrt(mean(W) / k)].
+ * Expected args: (X, k, m[, seed])
+ */
+static PyObject *symnmf_nystrom(PyObject *self, PyObject *args) {
+    PyObject *PyX, *PyH_out;
+    double **CX, **CH_init, **CH_out, scale;
+    int rows, cols, k, m, i, j;
+    unsigned long seed = 0;
+    lowrank_graph L;
+
+    if (!PyArg_ParseTuple(args, "Oii|k", &PyX, &k, &m, &seed))
+        return NULL;
+
+    if (parse_PyObject_to_2D_array(&PyX, &CX, &rows, &cols) != 0)
+        return NULL;
+
+    if (k < 1 || C_nystrom_norm(&L, &CX, rows, cols, m, seed) != 0) {
+        free_2D_array(&CX, rows);
+        return NULL;
+    }
+    free_2D_array(&CX, rows);
+
+    if (allocate_2D_array(&CH_init, rows, k) != 0) {
+        free_lowrank(&L);
+        return NULL;
+    }
+    scale = 2 * sqrt(lowrank_mean(&L) / k);
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < k; j++)
+            CH_init[i][j] = scale * (lcg_next(&seed) / 9007199254740992.0);
+    }
+
+    if (C_symnmf_lowrank(&CH_out, &CH_init, rows, k, &L) != 0) {
+        free_2D_array(&CH_init, rows);
+        free_lowrank(&L);
+        return NULL;
+    }
+
+    if (parse_2D_array_to_PyObject(&PyH_out, &CH_out, rows, k) != 0)
+        PyH_out = NULL;
+
+    free_2D_array(&CH_init, rows);
+    free_2D_array(&CH_out, rows);
+    free_lowrank(&L);
+    return PyH_out;
+}
+
+/*
+ * Returns the final H matrix computed on the normalized kNN similarity graph of X or NULL on failure.
+ */
+static PyObject *symnmf_knn(PyObject *self, PyObject *args) {
+    PyObject *PyX, *PyH_out;
+    double **CX, **CH_init, **CH_out, scale;
+    int rows, cols, k, neighbours, effort = 0, i, j;
+    unsigned long seed = 0;
+    knn_graph G;
+    sparse_graph S;
+
+    if (!PyArg_ParseTuple(args, "Oii|ik", &PyX, &k, &neighbours, &effort, &seed))
+        return NULL;
+
+    if (parse_PyObject_to_2D_array(&PyX, &CX, &rows, &cols) != 0)
+        return NULL;
+
+    if (k < 1 || C_knn(&G, &CX, rows, cols, neighbours, effort, seed) != 0) {
+        free_2D_array(&CX, rows);
+        return NULL;
+    }
+    free_2D_array(&CX, rows);
+    if (C_knn_norm(&S, &G) != 0) {
+        free_knn(&G);
+        return NULL;
+    }
+    free_knn(&G);
+
+    if (allocate_2D_array(&CH_init, rows, k) != 0) {
+        free_sparse(&S);
+        return NULL;
+    }
+    scale = 2 * sqrt(sparse_mean(&S) / k);
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < k; j++)
+            CH_init[i][j] = scale * (lcg_next(&seed) / 9007199254740992.0);
+    }
+
+    if (C_symnmf_sparse(&CH_out, &CH_init, rows, k, &S) != 0) {
+        free_2D_array(&CH_init, rows);
+        free_sparse(&S);
+        return NULL;
+    }
+
+    if (parse_2D_array_to_PyObject(&PyH_out, &CH_out, rows, k) != 0)
+        PyH_out = NULL;
+
+    free_2D_array(&CH_init, rows);
+    free_2D_array(&CH_out, rows);
+    free_sparse(&S);
+    return PyH_out;
+}
+
+/*
+ * Returns the final H matrix computed on the unique points of X, expanded back to every row of X,
+ * or NULL on failure.
+ * Expected args: (X, k[, quantum[, seed]])
+ */
+static PyObject *symnmf_dedup(PyObject *self, PyObject *args) {
+    PyObject *PyX, *PyH_out;
+    double **CX, **CU, **CW, **CH_init, **CH_unique, **CH_out, quantum = 0, scale;
+    int rows, cols, k, i, j, failed;
+    unsigned long seed = 0;
+    dedup_map map;
+
+    if (!PyArg_ParseTuple(args, "Oi|dk", &PyX, &k, &quantum, &seed))
+        return NULL;
+    if (k < 1 || !(quantum >= 0))
+        return NULL;
+
+    if (parse_PyObject_to_2D_array(&PyX, &CX, &rows, &cols) != 0)
+        return NULL;
+
+    if (C_dedup(&CU, &map, &CX, rows, cols, quantum) != 0) {
+        free_2D_array(&CX, rows);
+        return NULL;
+    }
+    free_2D_array(&CX, rows);
+    failed = C_dedup_norm(&CW, &CU, cols, &map);
+    free_2D_array(&CU, map.n);
+    if (failed || allocate_2D_array(&CH_init, map.n, k) != 0) {
+        if (!failed)
+            free_2D_array(&CW, map.n);
+        free_dedup(&map);
+        return NULL;
+    }
+
+    /* One H row per unique point: copies of a point get equal rows */
+    scale = 2 * sqrt(dedup_mean(&CW, &map) / k);
+    for (i = 0; i < map.n; i++) {
+        for (j = 0; j < k; j++)
+            CH_init[i][j] = scale * (lcg_next(&seed) / 9007199254740992.0);
+    }
+
+    failed = C_symnmf_weighted(&CH_unique, &CH_init, k, &CW, &map);
+    free_2D_array(&CH_init, map.n);
+    free_2D_array(&CW, map.n);
+    if (failed || expand_rows(&CH_out, &CH_unique, k, &map) != 0) {
+        if (!failed)
+            free_2D_array(&CH_unique, map.n);
+        free_dedup(&map);
+        return NULL;
+    }
+
+    if (parse_2D_array_to_PyObject(&PyH_out, &CH_out, rows, k) != 0)
+        PyH_out = NULL;
+
+    free_2D_array(&CH_unique, map.n);
+    free_2D_array(&CH_out, rows);
+    free_dedup(&map);
+    return PyH_out;
+}
+
+/*
+ * Returns the NNDSVD-style initial H of W or NULL on failure.
+ * Expected args: (W, k[, seed])
+ */
+static PyObject *init_nndsvd(PyObject *self, PyObject *args) {
+    PyObject *PyW, *PyH_out;
+    double **CW, **CH;
+    int N_W, k;
+    unsigned long seed = 0;
+
+    if (!PyArg_ParseTuple(args, "Oi|k", &PyW, &k, &seed))
+        return NULL;
+
+    if (parse_PyObject_to_2D_array(&PyW, &CW, &N_W, &N_W) != 0)
+        return NULL;
+
+    if (C_init_nndsvd(&CH, &CW, N_W, k, seed) != 0) {
+        free_2D_array(&CW, N_W);
+        return NULL;
+    }
+
+    if (parse_2D_array_to_PyObject(&PyH_out, &CH, N_W, k) != 0)
+        PyH_out = NULL;
+
+    free_2D_array(&CH, N_W);
+    free_2D_array(&CW, N_W);
+    return PyH_out;
+}
+
 /*
  * Returns the similarity matrix based on the instructions or NULL on failure.
  */
 static PyObject *sym(PyObject *self, PyObject *args) {
     PyObject *PyX, *PyA;
-    double **CX, **CA;
+    double **CX;
+    cache_entry *graph;
     int rows, cols, N;
 
     if (!PyArg_ParseTuple(args, "O", &PyX))
@@ -125,15 +403,19 @@ static PyObject *sym(PyObject *self, PyObject *args) {
     if (parse_PyObject_to_2D_array(&PyX, &CX, &rows, &cols) != 0)
         return NULL;
 
-    if (C_sym(&CA, &CX, rows, cols) != 0)
+    /* The graph is owned by the cache, repeated calls on the same X reuse it */
+    if (cache_get(&graph, &CX, rows, cols, 0) != 0) {
+        free_2D_array(&CX, rows);
         return NULL;
+    }
 
     N = rows;
 
-    parse_2D_array_to_PyObject(&PyA, &CA, N, N);
+    parse_2D_array_to_PyObject(&PyA, &graph->A, N, N);
 
+    /* A graph over the cache budget is not kept, it is freed as soon as it was copied out */
+    cache_release(graph);
     free_2D_array(&CX, rows);
-    free_2D_array(&CA, N);
     return PyA;
 }
 
@@ -142,7 +424,8 @@ static PyObject *sym(PyObject *self, PyObject *args) {
  */
 static PyObject *ddg(PyObject *self, PyObject *args) {
     PyObject *PyX, *PyD;
-    double **CX, **CA, *CD, **D_out;
+    double **CX, **D_out;
+    cache_entry *graph;
     int rows, cols, N;
 
     if (!PyArg_ParseTuple(args, "O", &PyX))
@@ -151,22 +434,23 @@ static PyObject *ddg(PyObject *self, PyObject *args) {
     if (parse_PyObject_to_2D_array(&PyX, &CX, &rows, &cols) != 0)
         return NULL;
 
-    if (C_sym(&CA, &CX, rows, cols) != 0)
+    if (cache_get(&graph, &CX, rows, cols, 0) != 0) {
+        free_2D_array(&CX, rows);
         return NULL;
+    }
 
     N = rows;
 
-    if (C_ddg(&CD, &CA, N) != 0)
-        return NULL;
-
-    if (parse_diag_to_matrix_form(&D_out, &CD, N) != 0)
+    if (parse_diag_to_matrix_form(&D_out, &graph->D, N) != 0) {
+        cache_release(graph);
+        free_2D_array(&CX, rows);
         return NULL;
+    }
+    cache_release(graph);
 
     parse_2D_array_to_PyObject(&PyD, &D_out, N, N);
 
     free_2D_array(&CX, rows);
-    free_2D_array(&CA, N);
-    free(CD);
     free_2D_array(&D_out, N);
     return PyD;
 }
@@ -176,7 +460,8 @@ static PyObject *ddg(PyObject *self, PyObject *args) {
  */
 static PyObject *norm(PyObject *self, PyObject *args) {
     PyObject *PyX, *PyW;
-    double **CX, **CA, *CD, **CW;
+    double **CX;
+    cache_entry *graph;
     int rows, cols, N;
 
     if (!PyArg_ParseTuple(args, "O", &PyX))
@@ -185,26 +470,54 @@ static PyObject *norm(PyObject *self, PyObject *args) {
     if (parse_PyObject_to_2D_array(&PyX, &CX, &rows, &cols) != 0)
         return NULL;
 
-    if (C_sym(&CA, &CX, rows, cols) != 0)
+    if (cache_get(&graph, &CX, rows, cols, 1) != 0) {
+        free_2D_array(&CX, rows);
         return NULL;
+    }
 
     N = rows;
 
-    if (C_ddg(&CD, &CA, N) != 0)
-        return NULL;
-
-    if (C_norm(&CW, &CD, &CA, N) != 0)
-        return NULL;
-
-    parse_2D_array_to_PyObject(&PyW, &CW, N, N);
+    parse_2D_array_to_PyObject(&PyW, &graph->W, N, N);
 
+    cache_release(graph);
     free_2D_array(&CX, rows);
-    free_2D_array(&CA, N);
-    free(CD);
-    free_2D_array(&CW, N);
     return PyW;
 }
 
+/*
+ * Spills the cached graphs to the disk store and frees them.
+ */
+static PyObject *clear_cache(PyObject *self, PyObject *args) {
+    cache_clear();
+    Py_RETURN_NONE;
+}
+
+/*
+ * Returns how the last large matrix was placed, e.g. "partition nodes=2 pages=thp bytes=33554432".
+ */
+static PyObject *placement(PyObject *self, PyObject *args) {
+    return PyUnicode_FromString(placement_describe());
+}
+
+/*
+ * Returns the outcome of the last symnmf call as (iterations, prev_objective, delta, reason), where reason is one
+ * of "max_iter", "delta", "objective", "stall" and "time".
+ * prev_objective is ||W - HH^T||^2 one update before the returned H, -1 unless rel_objective was on.
+ */
+static PyObject *report(PyObject *self, PyObject *args) {
+    static const char *reasons[] = {"max_iter", "delta", "objective", "stall", "time"};
+    return Py_BuildValue("(idds)", last_report.iterations, last_report.prev_objective, last_report.delta,
+                         reasons[last_report.reason]);
+}
+
+/*
+ * Tunes the kernels on this machine, puts the winners in effect and returns the path of the written profile.
+ */
+static PyObject *tune(PyObject *self, PyObject *args) {
+    if (tuning_run(NULL) != 0)
+        return NULL;
+    return PyUnicode_FromString(tuning_profile_path());
+}
 
 /* ------------ CPython API ------------ */
 static PyMethodDef symnmfMethods[] = {
@@ -212,6 +525,30 @@ static PyMethodDef symnmfMethods[] = {
                 (PyCFunction) symnmf,
                      METH_VARARGS,
                 PyDoc_STR("Returns the final H matrix")},
+        {"init_nndsvd",
+                (PyCFunction) init_nndsvd,
+                     METH_VARARGS,
+                PyDoc_STR("Returns the NNDSVD-style initial H matrix of W")},
+        {"symnmf_stochastic",
+                (PyCFunction) symnmf_stochastic,
+                     METH_VARARGS,
+                PyDoc_STR("Returns the final H matrix of the stochastic row-block mode")},
+        {"symnmf_distributed",
+                (PyCFunction) symnmf_distributed,
+                     METH_VARARGS,
+                PyDoc_STR("Returns the final H matrix computed by worker processes owning row partitions")},
+        {"symnmf_nystrom",
+                (PyCFunction) symnmf_nystrom,
+                     METH_VARARGS,
+                PyDoc_STR("Returns the final H matrix computed on a Nystrom low-rank approximation of W")},
+        {"symnmf_knn",
+                (PyCFunction) symnmf_knn,
+                     METH_VARARGS,
+                PyDoc_STR("Returns the final H matrix computed on the sparse kNN similarity graph of X")},
+        {"symnmf_dedup",
+                (PyCFunction) symnmf_dedup,
+                     METH_VARARGS,
+                PyDoc_STR("Returns the final H matrix computed on the unique points of X, one row per point of X")},
         {"sym",
                 (PyCFunction) sym,
                      METH_VARARGS,
@@ -224,6 +561,22 @@ static PyMethodDef symnmfMethods[] = {
                 (PyCFunction) norm,
                      METH_VARARGS,
                 PyDoc_STR("Returns the normalized similarity matrix")},
+        {"clear_cache",
+                (PyCFunction) clear_cache,
+                     METH_NOARGS,
+                PyDoc_STR("Spills the cached similarity graphs to SYMNMF_CACHE_DIR and frees them")},
+        {"placement",
+                (PyCFunction) placement,
+                     METH_NOARGS,
+                PyDoc_STR("Returns the NUMA and huge page placement of the last large matrix")},
+        {"report",
+                (PyCFunction) report,
+                     METH_NOARGS,
+                PyDoc_STR("Returns the iterations, prior objective, last step and stopping rule of the last symnmf")},
+        {"tune",
+                (PyCFunction) tune,
+                     METH_NOARGS,
+                PyDoc_STR("Tunes the kernels on this machine and returns the path of the written profile")},
 
         {NULL, NULL, 0, NULL}
 };
@@ -237,6 +590,10 @@ static struct PyModuleDef symnmfmodule = {
 };
 
 PyMODINIT_FUNC PyInit_symnmfmodule(void) {
+    /* Cached graphs are spilled to the disk store when the interpreter exits */
+    Py_AtExit(cache_clear);
+    /* Kernels follow the profile of 'tune', if this machine has one */
+    tuning_load();
     return PyModule_Create(&symnmfmodule);
 }
 
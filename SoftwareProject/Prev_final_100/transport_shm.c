@@ -0,0 +1,250 @@
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "dist.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/*
+ * Shared-memory transport: the workers are forked from the calling process and exchange data through
+ * one anonymous shared mapping, laid out as
+ * [shm_control][reduction slots: 'size' x 'reduce_len'][H rows: 'rows' x 'cols'].
+ * A worker that dies (signal, OOM kill) never reaches the barrier, so the waiters check that their
+ * peers are alive and raise 'aborted', which fails every later collective instead of hanging.
+ */
+
+typedef struct shm_control
+{
+    /* Sense reversing barrier */
+    volatile int count;
+    volatile int sense;
+    volatile int aborted;
+} shm_control;
+
+/* Number of double sized slots taken by shm_control at the start of the mapping */
+#define CONTROL_SLOTS ((sizeof(shm_control) + sizeof(double) - 1) / sizeof(double))
+
+typedef struct shm_impl
+{
+    shm_control *control;
+    double *slots, *rows_buf;
+    size_t map_len;
+    int reduce_len, rows, cols, local_sense, lost, exit_failed;
+    pid_t parent, *children;
+} shm_impl;
+
+/*
+ * Returns 1 if a peer of the calling worker is gone: rank 0 reaps children that exited, the others check
+ * their parent. A peer may also be gone because it passed the last barrier and finalized, the caller tells
+ * the two apart by the barrier sense.
+ */
+static int shm_peer_lost(transport *t)
+{
+    shm_impl *impl = (shm_impl *)t->impl;
+    int r, status;
+
+    if (t->rank != 0)
+        return getppid() != impl->parent;
+    for (r = 1; r < t->size; r++)
+    {
+        if (impl->children[r] > 0 && waitpid(impl->children[r], &status, WNOHANG) == impl->children[r])
+        {
+            /* Reaped here, finalize must not wait for it again */
+            impl->children[r] = 0;
+            impl->lost = 1;
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                impl->exit_failed = 1;
+        }
+    }
+    return impl->lost;
+}
+
+/*
+ * Sense reversing barrier over all workers.
+ * Returns 0 once every worker arrived, 1 if a worker died before that or the transport was aborted before.
+ */
+static int shm_barrier(transport *t)
+{
+    shm_impl *impl = (shm_impl *)t->impl;
+    shm_control *control = impl->control;
+
+    if (control->aborted)
+        return 1;
+    impl->local_sense = !impl->local_sense;
+    if (__sync_add_and_fetch(&control->count, 1) == t->size)
+    {
+        control->count = 0;
+        __sync_synchronize();
+        control->sense = impl->local_sense;
+    }
+    else
+    {
+        while (control->sense != impl->local_sense)
+        {
+            if (control->aborted || shm_peer_lost(t))
+            {
+                /* The last worker may flip the sense and finalize before this worker sees the flip */
+                __sync_synchronize();
+                if (control->sense == impl->local_sense)
+                {
+                    impl->lost = 0;
+                    break;
+                }
+                control->aborted = 1;
+                __sync_synchronize();
+                return 1;
+            }
+            sched_yield();
+        }
+    }
+    __sync_synchronize();
+    return 0;
+}
+
+static int shm_allreduce_sum(transport *t, double *buf, const int len)
+{
+    shm_impl *impl = (shm_impl *)t->impl;
+    int r, i;
+
+    if (len > impl->reduce_len)
+        return 1;
+    memcpy(impl->slots + (size_t)t->rank * impl->reduce_len, buf, len * sizeof(double));
+    if (shm_barrier(t) != 0)
+        return 1;
+
+    /* Every worker sums the slots in rank order, so all of them get bitwise identical sums */
+    memcpy(buf, impl->slots, len * sizeof(double));
+    for (r = 1; r < t->size; r++)
+    {
+        for (i = 0; i < len; i++)
+            buf[i] += impl->slots[(size_t)r * impl->reduce_len + i];
+    }
+    return shm_barrier(t);
+}
+
+static int shm_allgather_rows(transport *t, double **H, const int lo, const int hi, const int cols)
+{
+    shm_impl *impl = (shm_impl *)t->impl;
+    int i;
+
+    if (cols != impl->cols || hi > impl->rows)
+        return 1;
+    for (i = lo; i < hi; i++)
+        memcpy(impl->rows_buf + (size_t)i * cols, H[i], cols * sizeof(double));
+    if (shm_barrier(t) != 0)
+        return 1;
+    for (i = 0; i < impl->rows; i++)
+    {
+        if (i < lo || i >= hi)
+            memcpy(H[i], impl->rows_buf + (size_t)i * cols, cols * sizeof(double));
+    }
+    return shm_barrier(t);
+}
+
+static int shm_finalize(transport *t)
+{
+    shm_impl *impl = (shm_impl *)t->impl;
+    int r, status, failed = impl->lost || impl->exit_failed || impl->control->aborted;
+
+    if (t->rank != 0)
+        _exit(0);
+
+    for (r = 1; r < t->size; r++)
+    {
+        if (impl->children[r] <= 0)
+            continue;
+        if (waitpid(impl->children[r], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+    }
+    munmap((void *)impl->control, impl->map_len);
+    free(impl->children);
+    free(impl);
+    free(t);
+    return failed;
+}
+
+/*
+ * Forks 'size' - 1 workers sharing one mapping with the caller, which becomes rank 0.
+ * pre: '*t' is NOT dynamically allocated.
+ * Returns 0 on success in every worker.
+ */
+static int shm_launch(transport **t, const int size, const int rows, const int cols, const int reduce_len)
+{
+    shm_impl *impl;
+    void *map;
+    size_t map_len;
+    int r;
+    pid_t pid;
+
+    map_len = sizeof(double) * (CONTROL_SLOTS + (size_t)size * reduce_len + (size_t)rows * cols);
+    map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return 1;
+
+    *t = (transport *)calloc(1, sizeof(transport));
+    impl = (shm_impl *)calloc(1, sizeof(shm_impl));
+    if (impl != NULL)
+        impl->children = (pid_t *)calloc(size, sizeof(pid_t));
+    if (*t == NULL || impl == NULL || impl->children == NULL)
+    {
+        if (impl != NULL)
+            free(impl->children);
+        free(impl);
+        free(*t);
+        munmap(map, map_len);
+        return 1;
+    }
+
+    impl->control = (shm_control *)map;
+    impl->slots = (double *)map + CONTROL_SLOTS;
+    impl->rows_buf = impl->slots + (size_t)size * reduce_len;
+    impl->map_len = map_len;
+    impl->reduce_len = reduce_len;
+    impl->rows = rows;
+    impl->cols = cols;
+
+    (*t)->size = size;
+    (*t)->allreduce_sum = shm_allreduce_sum;
+    (*t)->allgather_rows = shm_allgather_rows;
+    (*t)->finalize = shm_finalize;
+    (*t)->impl = impl;
+    impl->parent = getpid();
+
+    for (r = 1; r < size; r++)
+    {
+        pid = fork();
+        if (pid < 0)
+        {
+            /* Workers that were already forked wait in the first barrier forever, stop them */
+            while (--r > 0)
+            {
+                kill(impl->children[r], SIGKILL);
+                waitpid(impl->children[r], NULL, 0);
+            }
+            munmap(map, map_len);
+            free(impl->children);
+            free(impl);
+            free(*t);
+            return 1;
+        }
+        if (pid == 0)
+        {
+            (*t)->rank = r;
+            return 0;
+        }
+        impl->children[r] = pid;
+    }
+    (*t)->rank = 0;
+    return 0;
+}
+
+const transport_backend shm_backend = {"shm", shm_launch};
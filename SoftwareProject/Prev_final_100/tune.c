@@ -0,0 +1,463 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "symnmf.h"
+#include "tune.h"
+#include "isa.h"
+#include "kernels.h"
+#include "stream.h"
+#include "ingest.h"
+
+#define CPUINFO "/proc/cpuinfo"
+#define CPU_KEY "model name"
+
+/*
+ * Autotuner. The profile of a machine is a text file of "key=value" lines, written by tuning_run and read by
+ * tuning_load at startup. It records the CPU it was tuned on: a profile found on another CPU (a shared home
+ * directory on a mixed fleet), a missing or unreadable one, or one with an out of range value leaves the
+ * defaults in place, which are the untuned behaviour.
+ */
+
+static const tuning defaults = {-1, 0, STREAM_BLOCK_BYTES, 0, 0};
+static tuning current = {-1, 0, STREAM_BLOCK_BYTES, 0, 0};
+
+/* Names of the fields in the profile, in the order of 'tuning' */
+static const char *keys[] = {"isa_level", "sym_tile", "stream_block_bytes", "generic_mask", "ingest_threads"};
+#define N_KEYS 5
+
+static int *field(tuning *t, const int i)
+{
+    int *fields[N_KEYS];
+    fields[0] = &t->isa_level;
+    fields[1] = &t->sym_tile;
+    fields[2] = &t->stream_block_bytes;
+    fields[3] = &t->generic_mask;
+    fields[4] = &t->ingest_threads;
+    return fields[i];
+}
+
+/*
+ * Returns the tuning parameters in effect.
+ */
+const tuning *tuning_current(void)
+{
+    return &current;
+}
+
+/*
+ * Puts '*t' in effect for the kernels chosen from now on.
+ */
+void tuning_set(const tuning *t)
+{
+    current = *t;
+    isa_reset();
+}
+
+/*
+ * Returns the profile path of this machine, see TUNE_PROFILE_ENV.
+ */
+const char *tuning_profile_path(void)
+{
+    static char path[1024];
+    char host[256], *env = getenv(TUNE_PROFILE_ENV), *home = getenv("HOME");
+
+    if (env != NULL)
+        return env;
+    if (gethostname(host, sizeof(host)) != 0)
+        strcpy(host, "localhost");
+    host[sizeof(host) - 1] = '\0';
+    sprintf(path, "%.700s/" TUNE_PROFILE_NAME, home != NULL ? home : ".", host);
+    return path;
+}
+
+/*
+ * Places the CPU model of this machine in 'cpu' (at most 'len' bytes), "unknown" where it can not be read.
+ */
+static void cpu_model(char *cpu, const int len)
+{
+    char line[512], *value;
+    FILE *file = fopen(CPUINFO, "r");
+
+    strcpy(cpu, "unknown");
+    while (file != NULL && fgets(line, sizeof(line), file) != NULL)
+    {
+        value = strchr(line, ':');
+        if (strncmp(line, CPU_KEY, strlen(CPU_KEY)) == 0 && value != NULL)
+        {
+            for (value++; *value == ' '; value++)
+                ;
+            value[strcspn(value, "\n")] = '\0';
+            strncpy(cpu, value, len - 1);
+            cpu[len - 1] = '\0';
+            break;
+        }
+    }
+    if (file != NULL)
+        fclose(file);
+}
+
+/*
+ * Returns 1 if every parameter of '*t' is in range.
+ */
+static int valid(const tuning *t)
+{
+    return t->isa_level >= -1 && t->isa_level <= ISA_AVX512 && t->sym_tile >= 0 && t->stream_block_bytes > 0 &&
+           t->ingest_threads >= 0 && t->ingest_threads <= 1024;
+}
+
+/*
+ * Reads the profile of this machine and puts it in effect.
+ * Returns 0 on success, 1 if the defaults stay in effect.
+ */
+int tuning_load(void)
+{
+    char line[512], cpu[256], *eq;
+    tuning t = defaults;
+    int i, cpu_matches = 0;
+    FILE *file = fopen(tuning_profile_path(), "r");
+
+    if (file == NULL)
+        return 1;
+    cpu_model(cpu, sizeof(cpu));
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line[strcspn(line, "\n")] = '\0';
+        eq = strchr(line, '=');
+        if (line[0] == '#' || eq == NULL)
+            continue;
+        *eq = '\0';
+        if (strcmp(line, "cpu") == 0)
+            cpu_matches = strcmp(eq + 1, cpu) == 0;
+        for (i = 0; i < N_KEYS; i++)
+        {
+            if (strcmp(line, keys[i]) == 0)
+                *field(&t, i) = atoi(eq + 1);
+        }
+    }
+    fclose(file);
+
+    if (!cpu_matches || !valid(&t))
+        return 1;
+    tuning_set(&t);
+    return 0;
+}
+
+/*
+ * Returns the monotonic wall clock in seconds.
+ */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Fills '*M' with uniform random values in [0, 1), from the generator '*state'.
+ * pre: '*M' is NOT dynamically allocated.
+ * Returns 0 on success.
+ */
+static int random_matrix(double ***M, const int rows, const int cols, unsigned long *state)
+{
+    int i, j;
+    if (allocate_2D_array(M, rows, cols) != 0)
+        return 1;
+    for (i = 0; i < rows; i++)
+    {
+        for (j = 0; j < cols; j++)
+            (*M)[i][j] = lcg_next(state) / 9007199254740992.0;
+    }
+    return 0;
+}
+
+/*
+ * Representative shapes: a few thousand points, low and high dimensional, a handful of clusters.
+ */
+#define SHAPE_N 2000
+#define SHAPE_D_LOW 4
+#define SHAPE_D_HIGH 64
+#define SHAPE_K 4
+#define SHAPE_ITERS 10
+
+/*
+ * Returns the fastest of TUNE_REPEATS runs, in seconds, of C_sym, C_ddg and C_norm on '*X' and of SHAPE_ITERS
+ * updates of an 'N' x 'k' H, all under the tuning '*t'. Returns -1 on failure.
+ */
+static double time_pipeline(const tuning *t, double ***X, const int N, const int d, double ***H, const int k)
+{
+    double **A, *D, **W, **H_out, best = -1, t0, t1;
+    int r, iter, failed = 0;
+
+    tuning_set(t);
+    if (allocate_2D_array(&H_out, N, k) != 0)
+        return -1;
+    for (r = 0; r < TUNE_REPEATS && !failed; r++)
+    {
+        t0 = now();
+        if (C_sym(&A, X, N, d) != 0)
+            break;
+        if (C_ddg(&D, &A, N) != 0 || C_norm(&W, &D, &A, N) != 0)
+        {
+            free_2D_array(&A, N);
+            break;
+        }
+        for (iter = 0; iter < SHAPE_ITERS && k > 0 && !failed; iter++)
+            failed = update_H(&H_out, H, N, k, &W, N) != 0;
+        t1 = now() - t0;
+        best = best < 0 || t1 < best ? t1 : best;
+        free_2D_array(&A, N);
+        free_2D_array(&W, N);
+        free(D);
+    }
+    free_2D_array(&H_out, N);
+    return failed ? -1 : best;
+}
+
+/*
+ * Returns the fastest of TUNE_REPEATS runs of C_sym alone on '*X' under '*t', -1 on failure.
+ */
+static double time_sym(const tuning *t, double ***X, const int N, const int d)
+{
+    double **A, best = -1, t0;
+    int r;
+
+    tuning_set(t);
+    for (r = 0; r < TUNE_REPEATS; r++)
+    {
+        t0 = now();
+        if (C_sym(&A, X, N, d) != 0)
+            return -1;
+        t0 = now() - t0;
+        best = best < 0 || t0 < best ? t0 : best;
+        free_2D_array(&A, N);
+    }
+    return best;
+}
+
+/*
+ * Returns the fastest of TUNE_REPEATS runs of SHAPE_ITERS updates of an 'N' x 'k' H under '*t', -1 on failure.
+ */
+static double time_updates(const tuning *t, double ***W, double ***H, const int N, const int k)
+{
+    double **H_out, best = -1, t0;
+    int r, iter;
+
+    tuning_set(t);
+    if (allocate_2D_array(&H_out, N, k) != 0)
+        return -1;
+    for (r = 0; r < TUNE_REPEATS; r++)
+    {
+        t0 = now();
+        for (iter = 0; iter < SHAPE_ITERS; iter++)
+        {
+            if (update_H(&H_out, H, N, k, W, N) != 0)
+            {
+                free_2D_array(&H_out, N);
+                return -1;
+            }
+        }
+        t0 = now() - t0;
+        best = best < 0 || t0 < best ? t0 : best;
+    }
+    free_2D_array(&H_out, N);
+    return best;
+}
+
+/*
+ * Returns the fastest of TUNE_REPEATS runs from the file 'path' to the degrees of its points under '*t',
+ * through the pipelined ingest or read_file and the streaming degree pass. Returns -1 on failure.
+ */
+static double time_ingest(const tuning *t, char *path)
+{
+    double **X, *D, best = -1, t0;
+    int r, N, d, failed;
+
+    tuning_set(t);
+    for (r = 0; r < TUNE_REPEATS; r++)
+    {
+        t0 = now();
+        if (t->ingest_threads > 0)
+            failed = ingest_file(&X, &D, &path, &N, &d, t->ingest_threads) != 0;
+        else if (read_file(&X, &path, &N, &d) != 0)
+            failed = 1;
+        else if (stream_degrees(&D, &X, N, d, NULL) != 0)
+        {
+            free_2D_array(&X, N);
+            failed = 1;
+        }
+        else
+            failed = 0;
+        if (failed)
+            return -1;
+        t0 = now() - t0;
+        best = best < 0 || t0 < best ? t0 : best;
+        free(D);
+        free_2D_array(&X, N);
+    }
+    return best;
+}
+
+/*
+ * Writes '*t' as the profile of this machine.
+ * Returns 0 on success.
+ */
+static int write_profile(const tuning *t)
+{
+    char cpu[256];
+    FILE *file = fopen(tuning_profile_path(), "w");
+    int i;
+
+    if (file == NULL)
+        return 1;
+    cpu_model(cpu, sizeof(cpu));
+    fprintf(file, "# symnmf tuning profile, written by 'symnmf tune'\ncpu=%s\n", cpu);
+    for (i = 0; i < N_KEYS; i++)
+        fprintf(file, "%s=%d\n", keys[i], *field((tuning *)t, i));
+    return fclose(file) != 0;
+}
+
+/*
+ * Sweeps the tuning parameters on the representative shapes, one parameter at a time with the winners of the
+ * earlier sweeps in effect, writes the winners to the profile of this machine and puts them in effect.
+ * Every candidate and its time is reported to 'log' if not NULL.
+ * Returns 0 on success. On failure the defaults are in effect.
+ */
+int tuning_run(FILE *log)
+{
+    static const int tiles[] = {0, 32, 64, 128, 256};
+    static const int blocks[] = {256 * 1024, 1024 * 1024, 4 * 1024 * 1024};
+    tuning best = defaults, t;
+    double **X_low, **X_high, **H, **A, *D, **W, time, time_high, best_time;
+    char path[] = "/tmp/symnmf_tune_XXXXXX";
+    unsigned long state = 0;
+    int i, j, k, top, cpus, fd;
+    FILE *file;
+
+    if (random_matrix(&X_low, SHAPE_N, SHAPE_D_LOW, &state) != 0)
+        return 1;
+    if (random_matrix(&X_high, SHAPE_N, SHAPE_D_HIGH, &state) != 0 || random_matrix(&H, SHAPE_N, 16, &state) != 0)
+    {
+        free_2D_array(&X_low, SHAPE_N);
+        return 1;
+    }
+
+    /* Kernel variant: every instruction set up to the best one of the CPU, on the whole sym-norm-update chain */
+    tuning_set(&defaults);
+    top = isa_select()->level;
+    best_time = -1;
+    for (i = ISA_GENERIC; i <= top; i++)
+    {
+        t = best;
+        t.isa_level = i;
+        time = time_pipeline(&t, &X_low, SHAPE_N, SHAPE_D_LOW, &H, SHAPE_K);
+        if (log != NULL)
+            fprintf(log, "isa_level=%d %.6f\n", i, time);
+        if (time >= 0 && (best_time < 0 || time < best_time))
+        {
+            best_time = time;
+            best.isa_level = i;
+        }
+    }
+
+    /* C_sym tile, on both shapes: tiles pay off once the rows of X outgrow the cache */
+    best_time = -1;
+    for (i = 0; i < (int)(sizeof(tiles) / sizeof(tiles[0])); i++)
+    {
+        t = best;
+        t.sym_tile = tiles[i];
+        time = time_sym(&t, &X_low, SHAPE_N, SHAPE_D_LOW);
+        time_high = time_sym(&t, &X_high, SHAPE_N, SHAPE_D_HIGH);
+        /* A failed shape fails the tile, -1 must not be summed into a valid time */
+        time = time < 0 || time_high < 0 ? -1 : time + time_high;
+        if (log != NULL)
+            fprintf(log, "sym_tile=%d %.6f\n", tiles[i], time);
+        if (time >= 0 && (best_time < 0 || time < best_time))
+        {
+            best_time = time;
+            best.sym_tile = tiles[i];
+        }
+    }
+
+    /* Specialized against generic update kernels, for every k with a specialization */
+    tuning_set(&best);
+    if (C_sym(&A, &X_low, SHAPE_N, SHAPE_D_LOW) == 0 && C_ddg(&D, &A, SHAPE_N) == 0 &&
+        C_norm(&W, &D, &A, SHAPE_N) == 0)
+    {
+        for (k = 2; k <= 16; k++)
+        {
+            if (select_kernels(k)->k != k)
+                continue;
+            t = best;
+            time = time_updates(&t, &W, &H, SHAPE_N, k);
+            t.generic_mask |= 1 << k;
+            best_time = time_updates(&t, &W, &H, SHAPE_N, k);
+            if (log != NULL)
+                fprintf(log, "k=%d specialized %.6f generic %.6f\n", k, time, best_time);
+            if (best_time >= 0 && time >= 0 && best_time < time)
+                best.generic_mask |= 1 << k;
+        }
+        free_2D_array(&A, SHAPE_N);
+        free_2D_array(&W, SHAPE_N);
+        free(D);
+    }
+
+    /* Ingest threads and the streaming block, from a file of the low dimensional shape */
+    fd = mkstemp(path);
+    file = fd < 0 ? NULL : fdopen(fd, "w");
+    if (file != NULL)
+    {
+        for (i = 0; i < SHAPE_N; i++)
+        {
+            for (j = 0; j < SHAPE_D_LOW; j++)
+                fprintf(file, "%.6f%c", X_low[i][j], j == SHAPE_D_LOW - 1 ? '\n' : ',');
+        }
+        fclose(file);
+
+        best_time = -1;
+        for (i = 0; i < (int)(sizeof(blocks) / sizeof(blocks[0])); i++)
+        {
+            t = best;
+            t.stream_block_bytes = blocks[i];
+            time = time_ingest(&t, path);
+            if (log != NULL)
+                fprintf(log, "stream_block_bytes=%d %.6f\n", blocks[i], time);
+            if (time >= 0 && (best_time < 0 || time < best_time))
+            {
+                best_time = time;
+                best.stream_block_bytes = blocks[i];
+            }
+        }
+
+        cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        for (i = 1; i <= cpus; i *= 2)
+        {
+            t = best;
+            t.ingest_threads = i;
+            time = time_ingest(&t, path);
+            if (log != NULL)
+                fprintf(log, "ingest_threads=%d %.6f\n", i, time);
+            if (time >= 0 && time < best_time)
+            {
+                best_time = time;
+                best.ingest_threads = i;
+            }
+        }
+        remove(path);
+    }
+
+    free_2D_array(&X_low, SHAPE_N);
+    free_2D_array(&X_high, SHAPE_N);
+    free_2D_array(&H, SHAPE_N);
+
+    if (write_profile(&best) != 0)
+    {
+        tuning_set(&defaults);
+        return 1;
+    }
+    tuning_set(&best);
+    return 0;
+}
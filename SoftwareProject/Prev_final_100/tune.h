@@ -0,0 +1,41 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stdio.h>
+
+/* Path of the tuning profile, by default $HOME/.symnmf-{hostname}.profile */
+#define TUNE_PROFILE_ENV "SYMNMF_PROFILE"
+#define TUNE_PROFILE_NAME ".symnmf-%s.profile"
+
+/* Every candidate is timed TUNE_REPEATS times and its fastest run counts */
+#define TUNE_REPEATS 3
+
+/*
+ * Tuning parameters of the similarity, normalization and update kernels.
+ * The defaults reproduce the untuned behaviour.
+ */
+typedef struct tuning
+{
+    /* isa_level of the kernels, -1 for the best the CPU supports */
+    int isa_level;
+    /* C_sym walks tiles of 'sym_tile' x 'sym_tile' pairs, 0 for whole rows */
+    int sym_tile;
+    /* Bytes of similarity rows the streaming goals form at once */
+    int stream_block_bytes;
+    /* Bit k set: the kernels specialized for k clusters are slower than the generic ones and are skipped */
+    int generic_mask;
+    /* Threads of the pipelined ingest when SYMNMF_INGEST_THREADS is unset, 0 for the sequential read */
+    int ingest_threads;
+} tuning;
+
+const tuning *tuning_current(void);
+
+int tuning_load(void);
+
+void tuning_set(const tuning *t);
+
+int tuning_run(FILE *log);
+
+const char *tuning_profile_path(void);
+
+#endif